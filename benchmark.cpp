@@ -0,0 +1,530 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "src/utilities.h"
+#include "src/vec3.h"
+#include "src/triangle_mesh.h"
+#include "src/triangle_packet.h"
+#include "src/aarect.h"
+#include "src/quad.h"
+#include "src/hittable_list.h"
+#include "src/box.h"
+#include "src/sphere.h"
+#include "src/bvh.h"
+#include "src/primitive_bvh.h"
+#include "src/camera.h"
+#include "src/material.h"
+#include "src/material_table.h"
+#include "src/arena.h"
+
+using namespace std::chrono;
+
+// Microbenchmarks for the hot intersection kernels
+// Build with optimizations (and -mavx2 for 8-wide packets), e.g.
+// g++ -std=c++17 -O2 -mavx2 -pthread benchmark.cpp -o benchmark
+// Add -DRAYTRACER_USE_FLOAT to measure the single precision build, and -DRAYTRACER_SIMD_VEC3
+// (with -mavx2 for double) to measure the SIMD vec3 backend against the scalar one
+
+
+// Tessellated unit sphere with {rings} * {segments} * 2 triangles
+shared_ptr<mesh_data> make_sphere_mesh(int rings, int segments)
+{
+    auto mesh = make_shared<mesh_data>();
+    for(int i = 0; i <= rings; i++)
+    {
+        for(int j = 0; j <= segments; j++)
+        {
+            auto theta = pi * i / rings;
+            auto phi = 2 * pi * j / segments;
+            mesh->owned.px.push_back(static_cast<float>(sin(theta) * cos(phi)));
+            mesh->owned.py.push_back(static_cast<float>(cos(theta)));
+            mesh->owned.pz.push_back(static_cast<float>(sin(theta) * sin(phi)));
+        }
+    }
+
+    for(int i = 0; i < rings; i++)
+    {
+        for(int j = 0; j < segments; j++)
+        {
+            uint32_t a = i * (segments + 1) + j;
+            uint32_t b = a + 1;
+            uint32_t c = a + segments + 1;
+            uint32_t d = c + 1;
+            mesh->owned.indices.insert(mesh->owned.indices.end(), {a, c, d, a, d, b});
+        }
+    }
+
+    mesh->bind_owned_buffers();
+    return mesh;
+}
+
+// Rays from random points around the unit sphere aimed at random points inside it
+std::vector<ray> make_rays(int count)
+{
+    std::vector<ray> rays;
+    for(int i = 0; i < count; i++)
+    {
+        auto origin = 3 * random_unit_vector();
+        rays.push_back(ray(origin, 0.5 * random_in_unit_sphere() - origin));
+    }
+    return rays;
+}
+
+void report(const std::string& name, double count, const std::string& unit, nanoseconds elapsed, double checksum)
+{
+    auto seconds = duration<double>(elapsed).count();
+    std::cout << name << ": " << count / seconds / 1e6 << " M" << unit << "/s"
+              << " (" << duration_cast<milliseconds>(elapsed).count() << " ms, checksum " << checksum << ")\n";
+}
+
+
+// One ray against every triangle of the mesh, scalar Moller-Trumbore vs triangle_packet
+void benchmark_triangle_kernels()
+{
+    auto mesh = make_sphere_mesh(64, 128);
+    auto rays = make_rays(2000);
+    const auto tri_count = mesh->triangle_count();
+
+    std::vector<triangle_packet> packets((tri_count + triangle_packet::width - 1) / triangle_packet::width);
+    for(uint32_t tri = 0; tri < tri_count; tri++)
+    {
+        packets[tri / triangle_packet::width].set(tri % triangle_packet::width, tri,
+                                                  mesh->position(mesh->indices(tri, 0)),
+                                                  mesh->position(mesh->indices(tri, 1)),
+                                                  mesh->position(mesh->indices(tri, 2)));
+    }
+
+    double checksum = 0;
+    auto t1 = high_resolution_clock::now();
+    for(const auto& r : rays)
+    {
+        real closest = infinity;
+        for(uint32_t tri = 0; tri < tri_count; tri++)
+        {
+            auto v0 = mesh->position(mesh->indices(tri, 0));
+            auto e1 = mesh->position(mesh->indices(tri, 1)) - v0;
+            auto e2 = mesh->position(mesh->indices(tri, 2)) - v0;
+            real t, b1, b2;
+            if(intersect_triangle(r.origin(), r.direction(), v0, e1, e2, 0.001, closest, t, b1, b2)) closest = t;
+        }
+        checksum += closest < infinity ? closest : 0;
+    }
+    auto t2 = high_resolution_clock::now();
+    report("scalar triangle tests", static_cast<double>(rays.size()) * tri_count, "tri", t2 - t1, checksum);
+
+    checksum = 0;
+    t1 = high_resolution_clock::now();
+    for(const auto& r : rays)
+    {
+        packet_ray pr(r);
+        real closest = infinity;
+        for(const auto& pk : packets)
+        {
+            real t, b1, b2;
+            if(intersect_packet(pk, pr, 0.001, closest, t, b1, b2) >= 0) closest = t;
+        }
+        checksum += closest < infinity ? closest : 0;
+    }
+    t2 = high_resolution_clock::now();
+    report(std::to_string(triangle_packet::width) + "-wide packet triangle tests", static_cast<double>(rays.size()) * tri_count, "tri", t2 - t1, checksum);
+}
+
+// Whole-mesh closest-hit queries through the mesh BVH with each storage layout, and the memory each layout reads
+void benchmark_mesh_traversal()
+{
+    auto mesh = make_sphere_mesh(512, 1024);
+    auto rays = make_rays(500000);
+
+    const std::pair<mesh_layout, std::string> layouts[] = {{mesh_layout::indexed, "indexed"}, {mesh_layout::packets, "packet"}, {mesh_layout::compressed, "compressed"}};
+    size_t packet_footprint = 0;
+    for(const auto& layout : layouts)
+    {
+        triangle_mesh tm(mesh, nullptr, layout.first);
+
+        double checksum = 0;
+        auto t1 = high_resolution_clock::now();
+        for(const auto& r : rays)
+        {
+            hit_record rec;
+            if(tm.hit(r, 0.001, infinity, rec)) checksum += rec.t;
+        }
+        auto t2 = high_resolution_clock::now();
+        report(layout.second + " mesh traversal", static_cast<double>(rays.size()), "rays", t2 - t1, checksum);
+
+        if(layout.first == mesh_layout::packets) packet_footprint = tm.footprint_bytes();
+        std::cout << "    footprint " << tm.footprint_bytes() / 1024 << " KB";
+        if(layout.first == mesh_layout::compressed) std::cout << " (" << 100.0 * tm.footprint_bytes() / packet_footprint << "% of the packet layout)";
+        std::cout << "\n";
+    }
+}
+
+// Box as a hittable_list of six axis-aligned rects (how box used to be built) vs the slab test box
+void benchmark_box()
+{
+    point3 p0(-0.5, -0.5, -0.5);
+    point3 p1(0.5, 0.5, 0.5);
+    auto rays = make_rays(100000);
+    const int passes = 20;
+
+    // Material pointers are never dereferenced here
+    shared_ptr<material> mat(static_cast<material*>(nullptr), [](material*) {});
+
+    hittable_list sides;
+    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat));
+    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat));
+    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat));
+    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat));
+    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat));
+    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat));
+    box slab_box(p0, p1, mat);
+
+    for(const hittable* h : {static_cast<const hittable*>(&sides), static_cast<const hittable*>(&slab_box)})
+    {
+        double checksum = 0;
+        auto t1 = high_resolution_clock::now();
+        for(int pass = 0; pass < passes; pass++)
+        {
+            for(const auto& r : rays)
+            {
+                hit_record rec;
+                if(h->hit(r, 0.001, infinity, rec)) checksum += rec.t;
+            }
+        }
+        auto t2 = high_resolution_clock::now();
+        report(h == &sides ? "six rect box" : "slab box", static_cast<double>(rays.size()) * passes, "rays", t2 - t1, checksum);
+    }
+}
+
+// Axis-aligned xz_rect vs the same rectangle as a quad, and a tilted quad of the same size
+void benchmark_quad()
+{
+    auto rays = make_rays(100000);
+    const int passes = 20;
+    shared_ptr<material> mat(static_cast<material*>(nullptr), [](material*) {});
+
+    xz_rect rect(-0.5, 0.5, -0.5, 0.5, 0, mat);
+    quad flat(point3(-0.5, 0, -0.5), vec3(1, 0, 0), vec3(0, 0, 1), mat);
+    quad tilted(point3(-0.5, -0.35, -0.35), vec3(1, 0, 0), vec3(0, 0.7, 0.7), mat);
+
+    for(const hittable* h : {static_cast<const hittable*>(&rect), static_cast<const hittable*>(&flat), static_cast<const hittable*>(&tilted)})
+    {
+        double checksum = 0;
+        auto t1 = high_resolution_clock::now();
+        for(int pass = 0; pass < passes; pass++)
+        {
+            for(const auto& r : rays)
+            {
+                hit_record rec;
+                if(h->hit(r, 0.001, infinity, rec)) checksum += rec.t;
+            }
+        }
+        auto t2 = high_resolution_clock::now();
+        report(h == &rect ? "xz_rect" : (h == &flat ? "axis-aligned quad" : "tilted quad"), static_cast<double>(rays.size()) * passes, "rays", t2 - t1, checksum);
+    }
+}
+
+// The vec3 operations the renderer spends its time in, on whichever vec3 backend this build uses
+void benchmark_vec3_kernels()
+{
+#if defined(VEC3_SIMD)
+    std::cout << "vec3 backend: " << sizeof(vec3_lanes) / sizeof(real) << "-lane SIMD, " << sizeof(vec3) << " bytes per vec3\n";
+#else
+    std::cout << "vec3 backend: scalar, " << sizeof(vec3) << " bytes per vec3\n";
+#endif
+
+    const int count = 4096;
+    const int passes = 5000;
+    std::vector<vec3> a, b;
+    for(int i = 0; i < count; i++)
+    {
+        a.push_back(vec3::random(-1, 1));
+        b.push_back(vec3::random(-1, 1));
+    }
+
+    double checksum = 0;
+    auto t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+        for(int i = 0; i < count; i++) checksum += dot(a[i], b[(i + pass) % count]);
+    auto t2 = high_resolution_clock::now();
+    report("vec3 dot", static_cast<double>(count) * passes, "ops", t2 - t1, checksum);
+
+    checksum = 0;
+    t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+        for(int i = 0; i < count; i++) checksum += cross(a[i], b[(i + pass) % count]).y();
+    t2 = high_resolution_clock::now();
+    report("vec3 cross", static_cast<double>(count) * passes, "ops", t2 - t1, checksum);
+
+    checksum = 0;
+    t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+        for(int i = 0; i < count; i++) checksum += unit_vector(a[i] + b[(i + pass) % count]).x();
+    t2 = high_resolution_clock::now();
+    report("vec3 normalize", static_cast<double>(count) * passes, "ops", t2 - t1, checksum);
+
+    checksum = 0;
+    t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+    {
+        auto lo = a[0], hi = a[0];
+        for(int i = 0; i < count; i++)
+        {
+            lo = component_min(lo, a[i] * b[(i + pass) % count]);
+            hi = component_max(hi, a[i] * b[(i + pass) % count]);
+        }
+        checksum += hi.x() - lo.z();
+    }
+    t2 = high_resolution_clock::now();
+    report("vec3 min/max", static_cast<double>(count) * passes, "ops", t2 - t1, checksum);
+
+    // Sphere intersection and a lambertian-style bounce, which is mostly vec3 arithmetic
+    auto rays = make_rays(100000);
+    sphere s(point3(0, 0, 0), 1, make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+
+    checksum = 0;
+    t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < 20; pass++)
+    {
+        for(size_t i = 0; i < rays.size(); i++)
+        {
+            hit_record rec;
+            if(s.hit(rays[i], 0.001, infinity, rec))
+            {
+                finalize_hit(rays[i], rec);
+                auto scattered = unit_vector(rec.normal + a[i % count]);
+                checksum += rec.t + dot(scattered, reflect(rec.normal, unit_vector(rays[i].direction())));
+            }
+        }
+    }
+    t2 = high_resolution_clock::now();
+    report("sphere hit + bounce", static_cast<double>(rays.size()) * 20, "rays", t2 - t1, checksum);
+}
+
+// Closest hits for the camera rays of a frame, one ray at a time vs packets of 4, 8 and 16 rays from tiles of pixels
+void benchmark_primary_packets()
+{
+    // Ground sphere with a grid of small spheres on it, seen from above like the random scene
+    shared_ptr<material> mat(static_cast<material*>(nullptr), [](material*) {});
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, mat));
+    for(int a = -11; a < 11; a++)
+        for(int b = -11; b < 11; b++) world.add(make_shared<sphere>(point3(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double()), 0.2, mat));
+    bvh_node scene(world, 0, 1);
+
+    const int width = 800, height = 450, passes = 5;
+    camera cam(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, real(width) / height, 0, 10);
+    std::vector<ray> rays;
+    for(int row = 0; row < height; row++)
+        for(int col = 0; col < width; col++) rays.push_back(cam.get_ray((col + 0.5) / (width - 1), (row + 0.5) / (height - 1)));
+
+    double checksum = 0;
+    auto t1 = high_resolution_clock::now();
+    for(int pass = 0; pass < passes; pass++)
+    {
+        for(const auto& r : rays)
+        {
+            hit_record rec;
+            if(scene.hit(r, 0.001, infinity, rec)) checksum += rec.t;
+        }
+    }
+    auto t2 = high_resolution_clock::now();
+    report("single primary rays", static_cast<double>(rays.size()) * passes, "rays", t2 - t1, checksum);
+
+    const std::pair<int, int> tiles[] = {{2, 2}, {4, 2}, {4, 4}};
+    for(const auto& tile : tiles)
+    {
+        checksum = 0;
+        ray_packet packet;
+        t1 = high_resolution_clock::now();
+        for(int pass = 0; pass < passes; pass++)
+        {
+            for(int tile_row = 0; tile_row < height; tile_row += tile.second)
+            {
+                for(int tile_col = 0; tile_col < width; tile_col += tile.first)
+                {
+                    packet.clear();
+                    for(int row = tile_row; row < tile_row + tile.second && row < height; row++)
+                        for(int col = tile_col; col < tile_col + tile.first && col < width; col++) packet.add(rays[row * width + col], infinity);
+
+                    packet.finish();
+                    scene.hit_packet(packet, packet.all(), 0.001);
+                    for(int i = 0; i < packet.size; i++)
+                        if(packet.hit_mask & (1u << i)) checksum += packet.recs[i].t;
+                }
+            }
+        }
+        t2 = high_resolution_clock::now();
+        report(std::to_string(tile.first * tile.second) + "-ray primary packets", static_cast<double>(rays.size()) * passes, "rays", t2 - t1, checksum);
+    }
+}
+
+// Scene of many small spheres, each with its own material, made with make_shared vs in a scene_arena
+// (with and without huge pages): time to build it with its BVH, to trace rays through it and to tear it down
+void benchmark_scene_arena()
+{
+    const int sphere_count = 100000;
+    auto rays = make_rays(100000);
+
+    for(int mode = 0; mode < 3; mode++)
+    {
+        auto t0 = high_resolution_clock::now();
+        double checksum = 0;
+        nanoseconds build, trace;
+        {
+            std::unique_ptr<scene_arena> arena;
+            if(mode > 0) arena.reset(new scene_arena(size_t(2) << 20, mode == 2));
+
+            hittable_list world;
+            for(int i = 0; i < sphere_count; i++)
+            {
+                auto center = point3(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+                auto albedo = color(random_double(), random_double(), random_double());
+                if(arena) world.add(arena->make<sphere>(center, 0.01, arena->make<lambertian>(albedo)));
+                else world.add(make_shared<sphere>(center, 0.01, make_shared<lambertian>(albedo)));
+            }
+            bvh_node scene(world, 0, 1, arena.get());
+            world.clear();
+            auto t1 = high_resolution_clock::now();
+            build = t1 - t0;
+
+            for(const auto& r : rays)
+            {
+                hit_record rec;
+                if(scene.hit(r, 0.001, infinity, rec)) checksum += rec.t;
+            }
+            trace = high_resolution_clock::now() - t1;
+            t0 = high_resolution_clock::now();
+        }
+        auto teardown = high_resolution_clock::now() - t0;
+
+        const std::string names[] = {"make_shared", "arena", "huge page arena"};
+        std::cout << names[mode] << " scene: build " << duration_cast<milliseconds>(build).count() << " ms, teardown "
+                  << duration_cast<microseconds>(teardown).count() / 1000.0 << " ms\n";
+        report("    " + names[mode] + " traversal", static_cast<double>(rays.size()), "rays", trace, checksum);
+    }
+}
+
+// Closest-hit queries through bvh_node (virtual calls for every node and primitive) vs primitive_bvh
+// (type-sorted arrays) on a mix of spheres, moving spheres, quads and boxes
+void benchmark_primitive_bvh()
+{
+    shared_ptr<material> mat(static_cast<material*>(nullptr), [](material*) {});
+    hittable_list world;
+    for(int i = 0; i < 4000; i++)
+    {
+        auto p = point3(random_double(-1, 1), random_double(-1, 1), random_double(-1, 1));
+        switch(i % 4)
+        {
+        case 0: world.add(make_shared<sphere>(p, 0.02, mat)); break;
+        case 1: world.add(make_shared<moving_sphere>(p, p + vec3(0, 0.02, 0), 0, 1, 0.02, mat)); break;
+        case 2: world.add(make_shared<quad>(p, vec3(0.04, 0, 0.01), vec3(0, 0.04, 0.01), mat)); break;
+        default: world.add(make_shared<box>(p, p + vec3(0.03, 0.03, 0.03), mat)); break;
+        }
+    }
+
+    bvh_node nodes(world, 0, 1);
+    primitive_bvh sorted(world, 0, 1);
+    auto rays = make_rays(200000);
+
+    for(const hittable* h : {static_cast<const hittable*>(&nodes), static_cast<const hittable*>(&sorted)})
+    {
+        double checksum = 0;
+        auto t1 = high_resolution_clock::now();
+        for(const auto& r : rays)
+        {
+            hit_record rec;
+            if(h->hit(r, 0.001, infinity, rec)) checksum += rec.t;
+        }
+        auto t2 = high_resolution_clock::now();
+        report(h == &nodes ? "bvh_node" : "primitive_bvh", static_cast<double>(rays.size()), "rays", t2 - t1, checksum);
+
+        checksum = 0;
+        t1 = high_resolution_clock::now();
+        for(const auto& r : rays) checksum += h->occluded(r, 0.001, infinity) ? 1 : 0;
+        t2 = high_resolution_clock::now();
+        report(h == &nodes ? "bvh_node occluded" : "primitive_bvh occluded", static_cast<double>(rays.size()), "rays", t2 - t1, checksum);
+    }
+}
+
+// Scattering a batch of hits on a mix of materials through the virtual functions and through a material_table,
+// in hit order and sorted by material id as the wavefront renderer does
+void benchmark_material_table()
+{
+    hittable_list world;
+    for(int i = 0; i < 64; i++)
+    {
+        shared_ptr<material> mat;
+        switch(i % 4)
+        {
+        case 0: mat = make_shared<lambertian>(color::random()); break;
+        case 1: mat = make_shared<metal>(color::random(), random_double(0, 0.5)); break;
+        case 2: mat = make_shared<dielectric>(1.5); break;
+        default: mat = make_shared<lambertian>(make_shared<checker_texture>(color(0, 0, 0), color(1, 1, 1))); break;
+        }
+        world.add(make_shared<sphere>(point3(i, 0, 0), 0.5, mat));
+    }
+    material_table table(world);
+
+    std::vector<const material*> materials;
+    world.collect_materials(materials);
+    auto rays = make_rays(200000);
+    std::vector<hit_record> hits(rays.size());
+    for(size_t i = 0; i < hits.size(); i++)
+    {
+        hits[i].p = rays[i].at(1);
+        hits[i].set_face_normal(rays[i], unit_vector(-rays[i].direction() + 0.5 * random_unit_vector()));
+        hits[i].t = 1;
+        hits[i].u = random_double();
+        hits[i].v = random_double();
+        hits[i].mat_ptr = materials[random_int(0, static_cast<int>(materials.size()) - 1)];
+    }
+
+    // The sorted batch is a copy, so that both batches are read front to back
+    std::vector<uint32_t> order(hits.size());
+    for(uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return table.id(hits[a].mat_ptr) < table.id(hits[b].mat_ptr); });
+    std::vector<ray> sorted_rays;
+    std::vector<hit_record> sorted_hits;
+    for(auto i : order)
+    {
+        sorted_rays.push_back(rays[i]);
+        sorted_hits.push_back(hits[i]);
+    }
+
+    for(int run = 0; run < 4; run++)
+    {
+        const bool use_table = run & 1;
+        const auto& batch_rays = run & 2 ? sorted_rays : rays;
+        const auto& batch_hits = run & 2 ? sorted_hits : hits;
+        double checksum = 0;
+        auto t1 = high_resolution_clock::now();
+        for(size_t i = 0; i < batch_hits.size(); i++)
+        {
+            scatter_record srec;
+            bool scatters = use_table ? table.scatter(batch_rays[i], batch_hits[i], srec)
+                                      : batch_hits[i].mat_ptr->scatter(batch_rays[i], batch_hits[i], srec);
+            if(scatters) checksum += srec.attenuation.x() + srec.scattered.direction().y();
+        }
+        auto t2 = high_resolution_clock::now();
+        std::string name = std::string(use_table ? "material_table" : "virtual scatter") + (run & 2 ? " sorted" : "");
+        report(name, static_cast<double>(batch_hits.size()), "hits", t2 - t1, checksum);
+    }
+}
+
+int main()
+{
+    benchmark_material_table();
+    benchmark_primitive_bvh();
+    benchmark_scene_arena();
+    benchmark_primary_packets();
+    benchmark_vec3_kernels();
+    benchmark_triangle_kernels();
+    benchmark_mesh_traversal();
+    benchmark_box();
+    benchmark_quad();
+
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <atomic>
+#include <algorithm>
 
 #include "src/ray.h"
 #include "src/vec3.h"
@@ -13,15 +15,49 @@
 #include "src/thread_pool.h"
 #include "src/utilities.h"
 #include "src/material.h"
+#include "src/material_table.h"
+#include "src/light_list.h"
 #include "src/moving_sphere.h"
 #include "src/bvh.h"
+#include "src/primitive_bvh.h"
 #include "src/aarect.h"
+#include "src/quad.h"
 #include "src/box.h"
+#include "src/transform.h"
 #include "src/constant_medium.h"
+#include "src/triangle_mesh.h"
+#include "src/obj_loader.h"
+#include "src/ply_loader.h"
+#include "src/sdf_object.h"
+#include "src/wavefront.h"
 #include "src/stb_image_write.h"
 
 using namespace std::chrono;
 
+// Colors of rays that leave the scene without hitting anything
+// Scenes lit only by their own lights, like the Cornell box, use the black background
+using background_function = color (*)(const ray& r);
+
+color black_background(const ray& r)
+{
+    return color(0, 0, 0);
+}
+
+color sky_background(const ray& r)
+{
+    auto unit_direction = unit_vector(r.direction());
+    auto t = 0.5 * (unit_direction.y() + 1);
+    return (1-t) * color(1, 1, 1) + t * color(0.5, 0.7, 1);
+}
+
+// Counts of one render call, for the average path length
+// {rays} is the number of rays traced, one per path segment
+struct path_stats
+{
+    uint64_t paths = 0;
+    uint64_t rays = 0;
+};
+
 // Struct for holding details that the render loop needs 
 struct render_info
 {
@@ -31,6 +67,30 @@ struct render_info
     int sample_count;
     const int max_depth;
     camera cam;
+    // The scene's materials, set once the scene is built
+    const material_table* materials = nullptr;
+    // The lights sampled at diffuse bounces, none if null
+    const light_list* lights = nullptr;
+    background_function background = sky_background;
+    // Cleared for scenes where nothing moves, whose camera rays then don't need times
+    bool motion_blur = true;
+    // Number of bounces after which paths may be ended by Russian roulette, max_depth or more turns it off
+    int roulette_depth = 3;
+
+    // Totals of all render calls, which add their counts once they finish
+    std::atomic<uint64_t> path_count{0};
+    std::atomic<uint64_t> ray_count{0};
+
+    void add_stats(const path_stats& stats)
+    {
+        path_count += stats.paths;
+        ray_count += stats.rays;
+    }
+
+    double average_path_length() const
+    {
+        return path_count ? static_cast<double>(ray_count) / path_count : 0.0;
+    }
 
     render_info(const int width, 
                 const int height,
@@ -49,34 +109,169 @@ struct render_info
 };
 
 
-// Core function for computing colors of pixels by shooting rays at objects in the scene
-// The function is recursive and calculates up to {max_depth} bounces before terminating
-color ray_color(const ray& r, const bvh_node& h, int max_depth)
+// Features of a render that are fixed at compile time in the code rendering it
+// The renderers are templates over a kernel, and dispatch_kernel() picks the one matching the camera, the scene and
+// the background once when a render call starts, so that per ray there are no branches or random numbers for the
+// features that are off. A null {background} stands for a background function set at runtime
+template<bool depth_of_field, bool motion_blur, background_function background>
+struct render_kernel
 {
-    if(max_depth <= 0)
+    static ray camera_ray(const render_info& rend_inf, real s, real t)
     {
-        return color(0, 0, 0);
+        return rend_inf.cam.get_ray<depth_of_field, motion_blur>(s, t);
     }
-    hit_record rec;
-    if(h.hit(r, 0.001, infinity, rec)) 
+
+    static color background_color(const render_info& rend_inf, const ray& r)
     {
-        ray scattered;
-        color attenuation;
-        if(rec.mat_ptr->scatter(r, rec, scattered, attenuation))
-            return attenuation * ray_color(scattered, h, max_depth-1);
-            
-        return rec.mat_ptr->emitted();  
+        if constexpr(background != nullptr) return background(r);
+        else return rend_inf.background(r);
     }
+};
 
-    // For black background
-    // return color(0, 0, 0);
+template<background_function background, typename F>
+void dispatch_camera(bool depth_of_field, bool motion_blur, F& render)
+{
+    if(depth_of_field)
+    {
+        if(motion_blur) render(render_kernel<true, true, background>());
+        else render(render_kernel<true, false, background>());
+    }
+    else
+    {
+        if(motion_blur) render(render_kernel<false, true, background>());
+        else render(render_kernel<false, false, background>());
+    }
+}
 
-    // For sky background 
-    // /*
-    auto unit_direction = unit_vector(r.direction());
-    auto t = 0.5 * (unit_direction.y() + 1);
-    return (1-t) * color(1, 1, 1) + t * color(0.5, 0.7, 1);
-    // */
+// Calls {render} with the kernel for {rend_inf}'s configuration
+template<typename F>
+void dispatch_kernel(const render_info& rend_inf, F&& render)
+{
+    const bool depth_of_field = rend_inf.cam.has_depth_of_field();
+    const bool motion_blur = rend_inf.motion_blur && rend_inf.cam.has_motion_blur();
+
+    if(rend_inf.background == sky_background) dispatch_camera<sky_background>(depth_of_field, motion_blur, render);
+    else if(rend_inf.background == black_background) dispatch_camera<black_background>(depth_of_field, motion_blur, render);
+    else dispatch_camera<nullptr>(depth_of_field, motion_blur, render);
+}
+
+// Russian roulette: a path carries on with a probability that follows its throughput, and the throughput of the paths
+// that do is divided by that probability. Paths that could only add little light mostly stop early, and the average
+// of what all paths bring is the same as without roulette, so the image isn't biased by it
+// The probability is at most 0.95, so that bright paths bouncing between bright surfaces also end
+bool survives_roulette(color& throughput)
+{
+    real p = std::min(real(0.95), std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+    if(random_double() >= p) return false;
+
+    throughput /= p;
+    return true;
+}
+
+// Power heuristic weight of a sample picked with density {pdf} by one technique, which another technique
+// could have picked with density {other_pdf}. The weights of the two always add up to one
+inline real power_heuristic(real pdf, real other_pdf)
+{
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// Whether the light at the hit scattered into {srec} is estimated by sampling the lights as well as the material
+bool samples_lights(const scatter_record& srec, const render_info& rend_inf)
+{
+    return rend_inf.lights && !rend_inf.lights->empty() && srec.pdf > 0;
+}
+
+// Next-event estimation: the light reaching the hit {rec} straight from a random point on a random light, if nothing
+// is in the way, times the material's BSDF and weighted against the material sampling the same direction
+color direct_light(const ray& r_in, const hit_record& rec, const hittable& h, const render_info& rend_inf)
+{
+    // Rays bounced off the surface leave from the same point, so both techniques see the lights from there
+    auto origin = offset_ray_origin(rec.p, rec.normal, rec.normal);
+
+    real pick_probability;
+    const auto* light = rend_inf.lights->sample(origin, pick_probability);
+    if(!light) return color(0, 0, 0);
+
+    vec3 to_light = light->object->random(origin);
+    if(dot(to_light, rec.normal) <= 0) return color(0, 0, 0);
+
+    auto light_pdf = pick_probability * light->object->pdf_value(origin, to_light);
+    if(light_pdf <= 0) return color(0, 0, 0);
+
+    real scatter_pdf;
+    color bsdf = rend_inf.materials->evaluate(r_in, rec, to_light, scatter_pdf);
+    if(scatter_pdf <= 0) return color(0, 0, 0);
+
+    // The ray reaches the light at t = 1, and the gaps left at both ends are kept to a fixed distance
+    ray shadow(origin, to_light, r_in.time());
+    auto gap = 0.001 / to_light.length();
+    if(h.occluded(shadow, gap, 1 - gap)) return color(0, 0, 0);
+
+    return bsdf * light->emission * (power_heuristic(light_pdf, scatter_pdf) / light_pdf);
+}
+
+// Emission of the light that {r} hit at {rec}, weighted against the lights having been sampled at the previous bounce
+// {scatter_pdf} is the density that bounce picked {r} with, 0 if it didn't sample the lights
+// {object} is the object the hit reported before being finalized
+color hit_emission(const ray& r, const hit_record& rec, const hittable* object, real scatter_pdf, const render_info& rend_inf)
+{
+    auto emission = rend_inf.materials->emitted(rec);
+    if(scatter_pdf <= 0 || !rend_inf.lights->contains(object)) return emission;
+
+    auto light_pdf = rend_inf.lights->probability(r.origin(), object) * object->pdf_value(r.origin(), r.direction());
+    return emission * power_heuristic(scatter_pdf, light_pdf);
+}
+
+// Color for a ray whose closest hit {first_rec} has already been found, or which missed everything if {first_hit} is false
+// The path is followed in a loop for up to {max_depth} bounces. {throughput} is the product of the attenuations
+// so far, which scales the light the path picks up when it leaves the scene or reaches an emitter; the loop keeps
+// one hit_record and one ray however long the path gets
+// Where the material has a density (diffuse and glossy surfaces) a shadow ray also picks up the light of a sampled
+// light. That light and the light the path finds by hitting a light are combined by multiple importance sampling,
+// so each counts most where its technique is the better one
+template<typename kernel>
+color shade(const ray& r, bool first_hit, const hit_record& first_rec, const hittable& h, const render_info& rend_inf, path_stats& stats)
+{
+    const auto& materials = *rend_inf.materials;
+    color radiance(0, 0, 0);
+    color throughput(1, 1, 1);
+    ray current = r;
+    hit_record rec = first_rec;
+    bool hit = first_hit;
+    real scatter_pdf = 0;
+    stats.paths++;
+
+    for(int depth = 0; depth < rend_inf.max_depth; depth++)
+    {
+        stats.rays++;
+        if(depth > 0) hit = h.hit(current, 0.001, infinity, rec);
+        if(!hit) return radiance + throughput * kernel::background_color(rend_inf, current);
+
+        const hittable* object = rec.object;
+        finalize_hit(current, rec);
+
+        scatter_record srec;
+        if(!materials.scatter(current, rec, srec))
+            return radiance + throughput * hit_emission(current, rec, object, scatter_pdf, rend_inf);
+
+        scatter_pdf = samples_lights(srec, rend_inf) ? srec.pdf : 0;
+        if(scatter_pdf > 0) radiance += throughput * direct_light(current, rec, h, rend_inf);
+
+        throughput = throughput * srec.attenuation;
+        if(depth >= rend_inf.roulette_depth && !survives_roulette(throughput)) break;
+        current = srec.scattered;
+    }
+
+    return radiance;
+}
+
+// Core function for computing colors of pixels by shooting rays at objects in the scene
+template<typename kernel>
+color ray_color(const ray& r, const hittable& h, const render_info& rend_inf, path_stats& stats)
+{
+    hit_record rec;
+    bool hit = rend_inf.max_depth > 0 && h.hit(r, 0.001, infinity, rec);
+    return shade<kernel>(r, hit, rec, h, rend_inf, stats);
 }
 
 // Utility function for converting color values to a string that holds the RGB values for a pixel
@@ -95,40 +290,188 @@ std::string write_color(color col)
 
 
 // Main render loop function, renders up to {no_samples} samples of the entire image and adds the result of pixelColors
-void render_lines(std::vector<color>& pixelColors, int no_samples, render_info& rend_inf, const bvh_node& h)
+// The image is covered in tiles of tile_width * tile_height pixels whose camera rays are traced as one packet
+// Bounced rays go in all directions, so they are traced one at a time
+template<typename kernel>
+void render_lines_kernel(std::vector<color>& pixelColors, int no_samples, render_info& rend_inf, const hittable& h)
+{
+    const int tile_width = 4;
+    const int tile_height = 4;
+    path_stats stats;
+
+    for(int samples = 0; samples < no_samples; samples++)
+    {
+        std::string log = "Samples remaining: " + std::to_string(rend_inf.sample_count) + "   \r";
+        std::cerr << log;
+        ray_packet packet;
+        for(int tile_row = rend_inf.img_height - 1; tile_row >= 0; tile_row -= tile_height)
+        {
+            for(int tile_col = 0; tile_col < rend_inf.img_width; tile_col += tile_width)
+            {
+                packet.clear();
+                int pixel[ray_packet::max_size];
+                for(int row = tile_row; row > tile_row - tile_height && row >= 0; row--)
+                {
+                    for(int col = tile_col; col < tile_col + tile_width && col < rend_inf.img_width; col++)
+                    {
+                        auto u = static_cast<double>(col + random_double()) / (rend_inf.img_width - 1);
+                        auto v = static_cast<double>(row + random_double()) / (rend_inf.img_height - 1);
+                        pixel[packet.size] = ((rend_inf.img_height - 1 - row) * rend_inf.img_width) + col;
+                        packet.add(kernel::camera_ray(rend_inf, u, v), infinity);
+                    }
+                }
+
+                packet.finish();
+                h.hit_packet(packet, packet.all(), 0.001);
+
+                for(int i = 0; i < packet.size; i++)
+                {
+                    bool hit = packet.hit_mask & (1u << i);
+                    pixelColors[pixel[i]] += shade<kernel>(packet.rays[i], hit, packet.recs[i], h, rend_inf, stats);
+                }
+            }
+        }
+        rend_inf.sample_count--;
+    }
+    rend_inf.add_stats(stats);
+}
+
+// Renders with the kernel for the configuration in {rend_inf}
+void render_lines(std::vector<color>& pixelColors, int no_samples, render_info& rend_inf, const hittable& h)
+{
+    dispatch_kernel(rend_inf, [&](auto kernel) { render_lines_kernel<decltype(kernel)>(pixelColors, no_samples, rend_inf, h); });
+}
+
+// Alternative to render_lines with the same result, which renders batches of paths one bounce at a time
+// Each bounce intersects every ray of the batch (sorted by direction octant, camera rays in packets), adds
+// the light of the rays that missed or hit a light, then scatters the rest (sorted by material) into the next bounce
+template<typename kernel>
+void render_wavefront_kernel(std::vector<color>& pixelColors, int no_samples, render_info& rend_inf, const hittable& h)
 {
+    const int batch_size = 1 << 13;
+    const int pixel_count = rend_inf.img_width * rend_inf.img_height;
+
+    std::vector<wavefront_path> paths, next;
+    std::vector<hit_record> hits;
+    std::vector<const hittable*> hit_objects;
+    std::vector<char> hit;
+    const auto& materials = *rend_inf.materials;
+    path_stats stats;
+    material_sorter sorter;
+    ray_packet packet;
+
     for(int samples = 0; samples < no_samples; samples++)
     {
         std::string log = "Samples remaining: " + std::to_string(rend_inf.sample_count) + "   \r";
         std::cerr << log;
-        for(int row = rend_inf.img_height - 1; row >= 0; row--)
+        for(int first_pixel = 0; first_pixel < pixel_count; first_pixel += batch_size)
         {
-            for(int col = 0; col < rend_inf.img_width; col++)
+            // Generate
+            paths.clear();
+            for(int pixel = first_pixel; pixel < std::min(first_pixel + batch_size, pixel_count); pixel++)
             {
+                auto row = rend_inf.img_height - 1 - pixel / rend_inf.img_width;
+                auto col = pixel % rend_inf.img_width;
                 auto u = static_cast<double>(col + random_double()) / (rend_inf.img_width - 1);
                 auto v = static_cast<double>(row + random_double()) / (rend_inf.img_height - 1);
-                ray r = rend_inf.cam.get_ray(u, v);
-                color px_col = ray_color(r, h, rend_inf.max_depth);
-                pixelColors[((rend_inf.img_height - 1 - row) * rend_inf.img_width) + col] += px_col;
+                paths.push_back({kernel::camera_ray(rend_inf, u, v), color(1, 1, 1), pixel});
+            }
+            stats.paths += paths.size();
+
+            for(int bounce = 0; bounce < rend_inf.max_depth && !paths.empty(); bounce++)
+            {
+                // Intersect
+                stats.rays += paths.size();
+                sort_by_octant(paths, next);
+                hits.resize(paths.size());
+                hit.assign(paths.size(), 0);
+                if(bounce == 0)
+                {
+                    for(size_t first = 0; first < paths.size(); first += ray_packet::max_size)
+                    {
+                        packet.clear();
+                        for(size_t i = first; i < std::min(first + ray_packet::max_size, paths.size()); i++) packet.add(paths[i].r, infinity);
+
+                        packet.finish();
+                        h.hit_packet(packet, packet.all(), 0.001);
+                        for(int i = 0; i < packet.size; i++)
+                        {
+                            hit[first + i] = (packet.hit_mask >> i) & 1;
+                            if(hit[first + i]) hits[first + i] = packet.recs[i];
+                        }
+                    }
+                }
+                else
+                {
+                    for(size_t i = 0; i < paths.size(); i++) hit[i] = h.hit(paths[i].r, 0.001, infinity, hits[i]);
+                }
+                hit_objects.resize(paths.size());
+                for(size_t i = 0; i < paths.size(); i++)
+                {
+                    if(!hit[i]) continue;
+                    hit_objects[i] = hits[i].object;
+                    finalize_hit(paths[i].r, hits[i]);
+                }
+
+                // Accumulate the rays that left the scene
+                for(size_t i = 0; i < paths.size(); i++)
+                {
+                    if(!hit[i]) pixelColors[paths[i].pixel] += paths[i].throughput * kernel::background_color(rend_inf, paths[i].r);
+                }
+
+                // Shade
+                sorter.sort(hits, hit, materials);
+                next.clear();
+                for(auto i : sorter.order())
+                {
+                    const auto& path = paths[i];
+                    scatter_record srec;
+                    if(!materials.scatter(path.r, hits[i], srec))
+                    {
+                        pixelColors[path.pixel] += path.throughput * hit_emission(path.r, hits[i], hit_objects[i], path.scatter_pdf, rend_inf);
+                        continue;
+                    }
+
+                    real scatter_pdf = samples_lights(srec, rend_inf) ? srec.pdf : 0;
+                    if(scatter_pdf > 0) pixelColors[path.pixel] += path.throughput * direct_light(path.r, hits[i], h, rend_inf);
+
+                    color throughput = path.throughput * srec.attenuation;
+                    if(bounce >= rend_inf.roulette_depth && !survives_roulette(throughput)) continue;
+                    next.push_back({srec.scattered, throughput, path.pixel, scatter_pdf});
+                }
+
+                paths.swap(next);
             }
         }
         rend_inf.sample_count--;
     }
+    rend_inf.add_stats(stats);
+}
+
+// Renders with the kernel for the configuration in {rend_inf}
+void render_wavefront(std::vector<color>& pixelColors, int no_samples, render_info& rend_inf, const hittable& h)
+{
+    dispatch_kernel(rend_inf, [&](auto kernel) { render_wavefront_kernel<decltype(kernel)>(pixelColors, no_samples, rend_inf, h); });
 }
 
 void output_ppm(std::vector<color>& pixelColors, double scale, int img_width, int img_height);
 void output_jpg(std::vector<color>& pixelColors, double scale, int img_width, int img_height);
 
 // Forward declarations of scene functions
-hittable_list random_scene();
-hittable_list two_perlin_spheres();
-hittable_list two_spheres();
-hittable_list cornell_box();
-hittable_list final_scene();
+hittable_list random_scene(scene_arena& arena);
+hittable_list two_perlin_spheres(scene_arena& arena);
+hittable_list two_spheres(scene_arena& arena);
+hittable_list cornell_box(scene_arena& arena);
+hittable_list final_scene(scene_arena& arena);
+hittable_list mesh_scene(const std::string& filename, thread_pool& pool, scene_arena& arena);
+hittable_list sdf_scene(scene_arena& arena);
 
 // Main entry function
 int main()
 {
+    // Memory for all scene objects, declared first so that it goes away after them
+    // scene_arena arena(size_t(2) << 20, true) backs it with huge pages
+    scene_arena arena;
     thread_pool pool;
 
     // Image dimensions
@@ -152,13 +495,31 @@ int main()
     render_info rend_inf(image_width, image_height, samples_per_pixel, samples_per_pixel, max_depth, cam);
 
     // Scene setup
-    // hittable_list scene_list = random_scene();
-    // hittable_list scene_list = cornell_box();
-    // hittable_list scene_list = final_scene();
-    hittable_list scene_list = two_perlin_spheres();
-    bvh_node scene(scene_list, 0.0, 1.0);
+    // hittable_list scene_list = random_scene(arena);
+    // hittable_list scene_list = cornell_box(arena);
+    // hittable_list scene_list = final_scene(arena);
+    // hittable_list scene_list = mesh_scene("models/model.obj", pool, arena);
+    // hittable_list scene_list = sdf_scene(arena);
+    hittable_list scene_list = two_perlin_spheres(arena);
+    // Either BVH works, primitive_bvh avoids most virtual calls during traversal
+    primitive_bvh scene(scene_list, 0.0, 1.0);
+    // bvh_node scene(scene_list, 0.0, 1.0, &arena);
+    // Materials are evaluated from a table compiled from the scene rather than through their classes
+    material_table materials(scene);
+    rend_inf.materials = &materials;
+    rend_inf.background = sky_background;
+    // rend_inf.background = black_background;
+    rend_inf.motion_blur = scene.moves();
+    // Diffuse and glossy surfaces sample the scene's lights directly, leaving rend_inf.lights null turns it off
+    light_list lights(scene);
+    rend_inf.lights = &lights;
+    // Paths may be ended by Russian roulette after their first three bounces, rend_inf.roulette_depth = max_depth turns it off
+    rend_inf.roulette_depth = 3;
 
     // Render loop
+    // Path by path (render_lines) or bounce by bounce over batches of paths (render_wavefront)
+    auto render = render_lines;
+    // auto render = render_wavefront;
     const int thread_count = pool.thread_count();
     int samples_per_thread = samples_per_pixel / (thread_count + 1);
     std::vector<std::future<void>> futures;
@@ -169,11 +530,11 @@ int main()
         // Multithreaded_version
         if(i == thread_count)
         {
-            render_lines(pixelColors, samples_per_pixel -  i * samples_per_thread, rend_inf, scene);
+            render(pixelColors, samples_per_pixel -  i * samples_per_thread, rend_inf, scene);
         }
         else
         {
-            futures.push_back(pool.submit(render_lines, std::ref(pixelColors), samples_per_thread, std::ref(rend_inf), std::ref(scene)));
+            futures.push_back(pool.submit(render, std::ref(pixelColors), samples_per_thread, std::ref(rend_inf), std::ref(scene)));
         }
 
         // Single threaded version
@@ -186,6 +547,7 @@ int main()
     }
     auto t2 = high_resolution_clock::now();
     std::cerr << "\nTime taken: " << duration_cast<milliseconds>(t2-t1).count();
+    std::cerr << "\nAverage path length: " << rend_inf.average_path_length() << " rays";
     std::cerr << "\nDone!";
     std::cerr << "\nWriting to file.";
     
@@ -248,11 +610,11 @@ void output_jpg(std::vector<color>& pixelColors, double scale, int img_width, in
 
 // Scenes
 // Scene with a large sphere serving as the ground, plus 3 big spheres and several smaller ones, with varying material types
-hittable_list random_scene() 
+hittable_list random_scene(scene_arena& arena) 
 {
     hittable_list world;
-    auto ground_material = make_shared<lambertian>(make_shared<checker_texture>(color(1, 1, 1), color(0.5, 0.5, 0.5)));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    auto ground_material = arena.make<lambertian>(arena.make<checker_texture>(color(1, 1, 1), color(0.5, 0.5, 0.5)));
+    world.add(arena.make<sphere>(point3(0,-1000,0), 1000, ground_material));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -264,90 +626,90 @@ hittable_list random_scene()
                 if (choose_mat < 0.8) {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
+                    sphere_material = arena.make<lambertian>(albedo);
                     auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(make_shared<moving_sphere>(center, center2, 0.0, 1.0, 0.2, sphere_material));
+                    world.add(arena.make<moving_sphere>(center, center2, 0.0, 1.0, 0.2, sphere_material));
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<metal>(albedo, fuzz);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 } else {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = arena.make<dielectric>(1.5);
+                    world.add(arena.make<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material1 = arena.make<dielectric>(1.5);
+    world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material2 = arena.make<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
+    auto material3 = arena.make<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
     return world;
 }
 
-hittable_list two_perlin_spheres()
+hittable_list two_perlin_spheres(scene_arena& arena)
 {
     hittable_list objects;
 
-    auto pertext = make_shared<noise_texture>(4);
-    objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(pertext)));
+    auto pertext = arena.make<noise_texture>(4);
+    objects.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(pertext)));
+    objects.add(arena.make<sphere>(point3(0, 2, 0), 2, arena.make<lambertian>(pertext)));
 
     return objects;
 }
 
-hittable_list two_spheres()
+hittable_list two_spheres(scene_arena& arena)
 {
     hittable_list objects;
 
-    objects.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0, 0.7, 0))));
-    objects.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(color(1, 0, 0))));
-    objects.add(make_shared<yz_rect>(0, 20, -25, 25, -10, make_shared<diffuse_light>(color(1, 1, 1))));
+    objects.add(arena.make<sphere>(point3(0, -1000, 0), 1000, arena.make<lambertian>(color(0, 0.7, 0))));
+    objects.add(arena.make<sphere>(point3(0, 2, 0), 2, arena.make<lambertian>(color(1, 0, 0))));
+    objects.add(arena.make<yz_rect>(0, 20, -25, 25, -10, arena.make<diffuse_light>(color(1, 1, 1))));
     return objects;
 }
 
-hittable_list cornell_box()
+hittable_list cornell_box(scene_arena& arena)
 {
     hittable_list objects;
 
-    auto red = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    auto red = arena.make<lambertian>(color(.65, .05, .05));
+    auto white = arena.make<lambertian>(color(.73, .73, .73));
+    auto green = arena.make<lambertian>(color(.12, .45, .15));
+    auto light = arena.make<diffuse_light>(color(7, 7, 7));
 
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+    objects.add(arena.make<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    objects.add(arena.make<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    objects.add(arena.make<quad>(point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+    objects.add(arena.make<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    objects.add(arena.make<quad>(point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    objects.add(arena.make<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
 
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295)); 
+    shared_ptr<hittable> box1 = arena.make<box>(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = arena.make<rotate_y>(box1, 15);
+    box1 = arena.make<translate>(box1, vec3(265, 0, 295)); 
 
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65)); 
+    shared_ptr<hittable> box2 = arena.make<box>(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = arena.make<rotate_y>(box2, -18);
+    box2 = arena.make<translate>(box2, vec3(130, 0, 65)); 
 
     objects.add(box1);
     objects.add(box2);
-    // objects.add(make_shared<constant_medium>(box1, 0.01, color(0, 0, 0)));
-    // objects.add(make_shared<constant_medium>(box2, 0.01, color(0, 0, 0)));
+    // objects.add(arena.make<constant_medium>(box1, 0.01, color(0, 0, 0)));
+    // objects.add(arena.make<constant_medium>(box2, 0.01, color(0, 0, 0)));
 
     return objects;
 }
 
-hittable_list final_scene() 
+hittable_list final_scene(scene_arena& arena) 
 {
     hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    auto ground = arena.make<lambertian>(color(0.48, 0.83, 0.53));
     const int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++) {
         for (int j = 0; j < boxes_per_side; j++) {
@@ -358,43 +720,81 @@ hittable_list final_scene()
             auto x1 = x0 + w;
             auto y1 = random_double(1,101);
             auto z1 = z0 + w;
-            boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+            boxes1.add(arena.make<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
         }
     }
     hittable_list objects;
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    objects.add(arena.make<bvh_node>(boxes1, 0, 1, &arena));
+    auto light = arena.make<diffuse_light>(color(7, 7, 7));
+    objects.add(arena.make<xz_rect>(123, 423, 147, 412, 554, light));
     auto center1 = point3(400, 400, 200);
     auto center2 = center1 + vec3(30,0,0);
-    auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
+    auto moving_sphere_material = arena.make<lambertian>(color(0.7, 0.3, 0.1));
 
-    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-    objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    objects.add(make_shared<sphere>(
-    point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
+    objects.add(arena.make<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+    objects.add(arena.make<sphere>(point3(260, 150, 45), 50, arena.make<dielectric>(1.5)));
+    objects.add(arena.make<sphere>(
+    point3(0, 150, 145), 50, arena.make<metal>(color(0.8, 0.8, 0.9), 1.0)
     ));
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
+    auto boundary = arena.make<sphere>(point3(360,150,145), 70, arena.make<dielectric>(1.5));
     objects.add(boundary);
-    objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000, make_shared<dielectric>(1.5));
-    objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("texture images/earthmap.jpg"));
-    objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1);
-    objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
+    objects.add(arena.make<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
+    boundary = arena.make<sphere>(point3(0, 0, 0), 5000, arena.make<dielectric>(1.5));
+    objects.add(arena.make<constant_medium>(boundary, .0001, color(1,1,1)));
+    auto emat = arena.make<lambertian>(arena.make<image_texture>("texture images/earthmap.jpg"));
+    objects.add(arena.make<sphere>(point3(400,200,400), 100, emat));
+    auto pertext = arena.make<noise_texture>(0.1);
+    objects.add(arena.make<sphere>(point3(220,280,300), 80, arena.make<lambertian>(pertext)));
     hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto white = arena.make<lambertian>(color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) 
     {
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+        boxes2.add(arena.make<sphere>(point3::random(0,165), 10, white));
     }
-    objects.add(make_shared<translate>(
-    make_shared<rotate_y>(
-    make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
+    objects.add(arena.make<translate>(
+    arena.make<rotate_y>(
+    arena.make<bvh_node>(boxes2, 0.0, 1.0, &arena), 15),
     vec3(-100,270,395)
     )   
     );
+    return objects;
+}
+
+// Triangle mesh loaded from an OBJ or binary PLY file, standing on a checkered ground sphere
+hittable_list mesh_scene(const std::string& filename, thread_pool& pool, scene_arena& arena)
+{
+    hittable_list objects;
+
+    auto ground_material = arena.make<lambertian>(arena.make<checker_texture>(color(1, 1, 1), color(0.5, 0.5, 0.5)));
+    objects.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    bool is_ply = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ply") == 0;
+    auto mesh = is_ply ? load_ply(filename) : load_obj(filename, &pool);
+    if(mesh->triangle_count() > 0)
+    {
+        objects.add(arena.make<triangle_mesh>(mesh, arena.make<lambertian>(color(0.73, 0.73, 0.73))));
+    }
+
+    return objects;
+}
+
+// Procedural shapes from signed distance functions: a Mandelbulb and a torus smoothly blended into a hollowed box
+hittable_list sdf_scene(scene_arena& arena)
+{
+    hittable_list objects;
+
+    auto ground_material = arena.make<lambertian>(arena.make<checker_texture>(color(1, 1, 1), color(0.5, 0.5, 0.5)));
+    objects.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    auto bulb = arena.make<sdf_mandelbulb>(point3(0, 1.2, 0), 1.0);
+    objects.add(arena.make<sdf_object>(bulb, arena.make<lambertian>(color(0.8, 0.6, 0.3)), 1e-4, 512, 64));
+
+    auto torus = arena.make<sdf_torus>(point3(2.5, 0.6, -1), 0.6, 0.15);
+    auto hollow_box = arena.make<sdf_difference>(arena.make<sdf_box>(point3(2.5, 0.6, -1), vec3(0.4, 0.4, 0.4), 0.05),
+                                                  arena.make<sdf_sphere>(point3(2.5, 0.6, -1), 0.5));
+    auto blend = arena.make<sdf_smooth_union>(torus, hollow_box, 0.2);
+    objects.add(arena.make<sdf_object>(blend, arena.make<metal>(color(0.8, 0.8, 0.9), 0.1)));
+
     return objects;
 }
\ No newline at end of file
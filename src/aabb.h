@@ -1,6 +1,7 @@
 #ifndef _AABB_h
 #define _AABB_h
 
+#include <algorithm>
 #include "utilities.h"
 
 class aabb
@@ -12,7 +13,7 @@ public:
     point3 min() const { return minimum; }
     point3 max() const { return maximum; }
 
-    bool hit(const ray& r, double t_min, double t_max) const
+    bool hit(const ray& r, real t_min, real t_max) const
     {
         for(auto a = 0; a < 3; a++)
         {
@@ -31,22 +32,58 @@ public:
         return true;
     }
 
+    // Slab test taking a precomputed reciprocal ray direction, for traversal loops that test
+    // many boxes against the same ray. Flat boxes (e.g. around axis-aligned triangles) still count as hit
+    bool hit(const point3& origin, const vec3& inv_dir, real t_min, real t_max) const
+    {
+        for(auto a = 0; a < 3; a++)
+        {
+            auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+            auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+            if(inv_dir[a] < 0.0) std::swap(t0, t1);
+
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+
+            if(t_max < t_min) return false;
+        }
+
+        return true;
+    }
+
+    // Conservative test for a group of rays whose origins lie in [o_min, o_max] and whose reciprocal
+    // directions lie in [inv_min, inv_max], with no interval containing 0. False means that none of
+    // the rays can hit the box, true that some of them may
+    bool hit(const point3& o_min, const point3& o_max, const vec3& inv_min, const vec3& inv_max, real t_min, real t_max) const
+    {
+        for(auto a = 0; a < 3; a++)
+        {
+            // The near plane is the same for all rays, since their directions have the same sign
+            auto near_plane = inv_min[a] > 0 ? minimum[a] : maximum[a];
+            auto far_plane = inv_min[a] > 0 ? maximum[a] : minimum[a];
+
+            // Smallest entry and largest exit distance over the intervals, from the products of their ends
+            auto n0 = near_plane - o_max[a], n1 = near_plane - o_min[a];
+            auto f0 = far_plane - o_max[a], f1 = far_plane - o_min[a];
+            auto t0 = std::min(std::min(n0 * inv_min[a], n0 * inv_max[a]), std::min(n1 * inv_min[a], n1 * inv_max[a]));
+            auto t1 = std::max(std::max(f0 * inv_min[a], f0 * inv_max[a]), std::max(f1 * inv_min[a], f1 * inv_max[a]));
+
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+
+            if(t_max < t_min) return false;
+        }
+
+        return true;
+    }
+
     point3 minimum;
     point3 maximum;
 };
 
 aabb surrounding_box(aabb box0, aabb box1)
 {
-    point3 small(fmin(box0.min().x(), box1.min().x()),
-                 fmin(box0.min().y(), box1.min().y()),
-                 fmin(box0.min().z(), box1.min().z()));  
-
-                 
-    point3 big(fmax(box0.max().x(), box1.max().x()),
-               fmax(box0.max().y(), box1.max().y()),
-               fmax(box0.max().z(), box1.max().z()));  
-
-    return aabb(small, big);
+    return aabb(component_min(box0.min(), box1.min()), component_max(box0.max(), box1.max()));
 }
 
 #endif
@@ -3,31 +3,40 @@
 
 #include "utilities.h"
 #include "hittable.h"
-
-class material;
+#include "material.h"
 
 class xy_rect : public hittable
 {
 public:
     xy_rect() {}
-    xy_rect(double x0_, double x1_, double y0_, double y1_, double k, shared_ptr<material> m_ptr) 
+    xy_rect(real x0_, real x1_, real y0_, real y1_, real k, shared_ptr<material> m_ptr) 
     : x0(x0_), x1(x1_), y0(y0_), y1(y1_), z(k), mat(m_ptr) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         output_box = aabb(point3(x0, y0, z-0.0001), point3(x1, y1, z+0.0001));
         return true;
     }
 
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override { add_light(lights, this, mat.get(), (x1 - x0) * (y1 - y0), vec3(0, 0, 1), 0); }
+
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override;
+    virtual vec3 random(const point3& origin) const override;
     
 private:
-    double x0, y0, x1, y1, z;
+    real x0, y0, x1, y1, z;
     shared_ptr<material> mat;
 };
 
-bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool xy_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     auto t = (z - r.origin().z()) / r.direction().z();
     if(t < t_min || t > t_max) return false;
@@ -38,14 +47,51 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     if(x < x0 || x > x1 || y < y0 || y > y1) return false;
     // Hit confirmed
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
+    rec.b1 = x;
+    rec.b2 = y;
+    rec.object = this;
+    return true;
+}
+
+void xy_rect::finalize(const ray& r, hit_record& rec) const
+{
+    if(needs_uv(mat.get()))
+    {
+        rec.u = (rec.b1 - x0) / (x1 - x0);
+        rec.v = (rec.b2 - y0) / (y1 - y0);
+    }
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mat.get();
+    rec.p = r.at(rec.t);
+}
+
+bool xy_rect::occluded(const ray& r, real t_min, real t_max) const
+{
+    auto t = (z - r.origin().z()) / r.direction().z();
+    if(t < t_min || t > t_max) return false;
+
+    auto x = r.origin().x() + t*r.direction().x();
+    auto y = r.origin().y() + t*r.direction().y();
+
+    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+}
+
+// Uniform sampling over the area, converted to a density over solid angle
+real xy_rect::pdf_value(const point3& origin, const vec3& direction) const
+{
+    hit_record rec;
+    if(!hit(ray(origin, direction), 0.001, infinity, rec)) return 0;
+
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = fabs(direction.z()) / direction.length();
+    return distance_squared / (cosine * (x1 - x0) * (y1 - y0));
+}
+
+vec3 xy_rect::random(const point3& origin) const
+{
+    return point3(random_double(x0, x1), random_double(y0, y1), z) - origin;
 }
 
 
@@ -53,22 +99,33 @@ class xz_rect : public hittable
 {
 public:
     xz_rect() {}
-    xz_rect(double x0_, double x1_, double z0_, double z1_, double y_, shared_ptr<material> mat_) 
+    xz_rect(real x0_, real x1_, real z0_, real z1_, real y_, shared_ptr<material> mat_) 
     : x0(x0_), x1(x1_), z0(z0_), z1(z1_), y(y_), mat(mat_) {} 
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         output_box = aabb(point3(x0, y-0.0001, z0), point3(x1, y+0.0001, z1));
         return true;;
     }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override { add_light(lights, this, mat.get(), (x1 - x0) * (z1 - z0), vec3(0, 1, 0), 0); }
+
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override;
+    virtual vec3 random(const point3& origin) const override;
 private:
-    double x0, x1, z0, z1, y;
+    real x0, x1, z0, z1, y;
     shared_ptr<material> mat;
 };
 
-bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool xz_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     auto t = (y - r.origin().y()) / r.direction().y();
     if(t < t_min || t > t_max) return false;
@@ -77,14 +134,51 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto z = r.origin().z() + t * r.direction().z();
     if(x < x0 || x > x1 || z < z0 || z > z1) return false;
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.b1 = x;
+    rec.b2 = z;
+    rec.object = this;
+    return true;
+}
+
+void xz_rect::finalize(const ray& r, hit_record& rec) const
+{
+    if(needs_uv(mat.get()))
+    {
+        rec.u = (rec.b1 - x0) / (x1 - x0);
+        rec.v = (rec.b2 - z0) / (z1 - z0);
+    }
     vec3 outward_normal(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat;
+    rec.mat_ptr = mat.get();
     rec.p = r.at(rec.t);
-    return true;
+}
+
+bool xz_rect::occluded(const ray& r, real t_min, real t_max) const
+{
+    auto t = (y - r.origin().y()) / r.direction().y();
+    if(t < t_min || t > t_max) return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto z = r.origin().z() + t * r.direction().z();
+
+    return x >= x0 && x <= x1 && z >= z0 && z <= z1;
+}
+
+// Uniform sampling over the area, converted to a density over solid angle
+real xz_rect::pdf_value(const point3& origin, const vec3& direction) const
+{
+    hit_record rec;
+    if(!hit(ray(origin, direction), 0.001, infinity, rec)) return 0;
+
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = fabs(direction.y()) / direction.length();
+    return distance_squared / (cosine * (x1 - x0) * (z1 - z0));
+}
+
+vec3 xz_rect::random(const point3& origin) const
+{
+    return point3(random_double(x0, x1), y, random_double(z0, z1)) - origin;
 }
 
 
@@ -92,22 +186,33 @@ class yz_rect : public hittable
 {
 public:
     yz_rect() {}
-    yz_rect(double y0_, double y1_, double z0_, double z1_, double x_, shared_ptr<material> mat_)
+    yz_rect(real y0_, real y1_, real z0_, real z1_, real x_, shared_ptr<material> mat_)
     : y0(y0_), y1(y1_), z0(z0_), z1(z1_), x(x_), mat(mat_) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         output_box = aabb(point3(x-0.0001, y0, z0), point3(x+0.0001, y1, z1));
         return true;
     }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override { add_light(lights, this, mat.get(), (y1 - y0) * (z1 - z0), vec3(1, 0, 0), 0); }
+
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override;
+    virtual vec3 random(const point3& origin) const override;
 private:
-    double y0, y1, z0, z1, x;
+    real y0, y1, z0, z1, x;
     shared_ptr<material> mat;
 };
 
-bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool yz_rect::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     auto t = (x - r.origin().x()) / r.direction().x();
     if(t < t_min || t > t_max) return false;
@@ -116,14 +221,51 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     auto z = r.origin().z() + t * r.direction().z();
     if(y < y0 || y > y1 || z < z0 || z > z1) return false;
 
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
+    rec.b1 = y;
+    rec.b2 = z;
+    rec.object = this;
+    return true;
+}
+
+void yz_rect::finalize(const ray& r, hit_record& rec) const
+{
+    if(needs_uv(mat.get()))
+    {
+        rec.u = (rec.b1 - y0) / (y1 - y0);
+        rec.v = (rec.b2 - z0) / (z1 - z0);
+    }
     vec3 outward_normal(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat;
-    rec.p = r.at(t);
-    return true;
+    rec.mat_ptr = mat.get();
+    rec.p = r.at(rec.t);
+}
+
+bool yz_rect::occluded(const ray& r, real t_min, real t_max) const
+{
+    auto t = (x - r.origin().x()) / r.direction().x();
+    if(t < t_min || t > t_max) return false;
+
+    auto y = r.origin().y() + t * r.direction().y();
+    auto z = r.origin().z() + t * r.direction().z();
+
+    return y >= y0 && y <= y1 && z >= z0 && z <= z1;
+}
+
+// Uniform sampling over the area, converted to a density over solid angle
+real yz_rect::pdf_value(const point3& origin, const vec3& direction) const
+{
+    hit_record rec;
+    if(!hit(ray(origin, direction), 0.001, infinity, rec)) return 0;
+
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = fabs(direction.x()) / direction.length();
+    return distance_squared / (cosine * (y1 - y0) * (z1 - z0));
+}
+
+vec3 yz_rect::random(const point3& origin) const
+{
+    return point3(x, random_double(y0, y1), random_double(z0, z1)) - origin;
 }
 
 #endif
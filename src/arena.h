@@ -0,0 +1,179 @@
+#ifndef _ARENA_h
+#define _ARENA_h
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+// Monotonic arena that owns the memory of a scene's objects
+// Objects are placed one after another in large chunks, so the primitives, materials and BVH nodes a
+// ray visits together are close together in memory, and all of it is released at once when the arena
+// goes away. Objects are made with make<T>(), which returns an ordinary shared_ptr whose object and
+// reference count both live in the arena; destructors still run as usual, only freeing is skipped
+// With {huge_pages} the chunks are backed by 2 MB pages where the system allows it, which cuts down
+// TLB misses when traversing large scenes
+// The arena must outlive every object made in it, and isn't thread safe
+class scene_arena
+{
+public:
+    scene_arena(size_t chunk_size=size_t(2) << 20, bool huge_pages=false) : m_chunk_size(chunk_size), m_huge_pages(huge_pages) {}
+
+    ~scene_arena()
+    {
+        for(const auto& c : m_chunks) release(c);
+    }
+
+    scene_arena(const scene_arena&)=delete;
+    scene_arena& operator=(const scene_arena&)=delete;
+
+    void* allocate(size_t bytes, size_t alignment)
+    {
+        if(m_chunks.empty() || align_offset(alignment) + bytes > m_chunks.back().size) add_chunk(bytes + alignment);
+
+        auto aligned = align_offset(alignment);
+        m_offset = aligned + bytes;
+        m_used += bytes;
+        return m_chunks.back().data + aligned;
+    }
+
+    template<typename T, typename... Args>
+    std::shared_ptr<T> make(Args&&... args);
+
+    // Bytes handed out, and bytes reserved from the system
+    size_t used_bytes() const { return m_used; }
+    size_t reserved_bytes() const
+    {
+        size_t total = 0;
+        for(const auto& c : m_chunks) total += c.size;
+        return total;
+    }
+
+private:
+    struct chunk
+    {
+        unsigned char* data;
+        size_t size;
+        bool mapped;
+    };
+
+    // First offset in the current chunk past the used part whose address is a multiple of {alignment}
+    size_t align_offset(size_t alignment) const
+    {
+        auto address = reinterpret_cast<uintptr_t>(m_chunks.back().data) + m_offset;
+        return m_offset + ((alignment - address % alignment) % alignment);
+    }
+
+    void add_chunk(size_t min_size);
+    static void release(const chunk& c);
+
+    size_t m_chunk_size;
+    bool m_huge_pages;
+    std::vector<chunk> m_chunks;
+    size_t m_offset = 0;
+    size_t m_used = 0;
+};
+
+// Standard allocator over a scene_arena, for std::allocate_shared and containers
+// Deallocation does nothing, the memory is reclaimed with the arena
+template<typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    arena_allocator(scene_arena& arena) : m_arena(&arena) {}
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U>& other) : m_arena(other.arena()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    scene_arena* arena() const { return m_arena; }
+
+    template<typename U>
+    bool operator==(const arena_allocator<U>& other) const { return m_arena == other.arena(); }
+    template<typename U>
+    bool operator!=(const arena_allocator<U>& other) const { return m_arena != other.arena(); }
+
+private:
+    scene_arena* m_arena;
+};
+
+template<typename T, typename... Args>
+std::shared_ptr<T> scene_arena::make(Args&&... args)
+{
+    return std::allocate_shared<T>(arena_allocator<T>(*this), std::forward<Args>(args)...);
+}
+
+void scene_arena::add_chunk(size_t min_size)
+{
+    const size_t huge_page = size_t(2) << 20;
+    auto size = min_size > m_chunk_size ? min_size : m_chunk_size;
+    if(m_huge_pages) size = (size + huge_page - 1) & ~(huge_page - 1);
+
+    void* data = nullptr;
+    bool mapped = false;
+#ifdef _WIN32
+    if(m_huge_pages)
+    {
+        // Needs the "Lock pages in memory" privilege, without it the normal pages below are used
+        auto large = GetLargePageMinimum();
+        if(large > 0 && size % large == 0) data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if(!data) data = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    mapped = data != nullptr;
+#else
+    if(m_huge_pages)
+    {
+    #ifdef MAP_HUGETLB
+        // Reserved huge pages first, which are often not configured
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) data = ptr;
+    #endif
+        if(!data)
+        {
+            // Otherwise ask for transparent huge pages
+            void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(ptr != MAP_FAILED)
+            {
+                data = ptr;
+    #ifdef MADV_HUGEPAGE
+                madvise(ptr, size, MADV_HUGEPAGE);
+    #endif
+            }
+        }
+        mapped = data != nullptr;
+    }
+#endif
+    if(!data) data = ::operator new(size);
+
+    m_chunks.push_back({static_cast<unsigned char*>(data), size, mapped});
+    m_offset = 0;
+}
+
+void scene_arena::release(const chunk& c)
+{
+    if(!c.mapped)
+    {
+        ::operator delete(c.data);
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(c.data, 0, MEM_RELEASE);
+#else
+    munmap(c.data, c.size);
+#endif
+}
+
+#endif
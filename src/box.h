@@ -2,48 +2,117 @@
 #define _BOX_h
 
 #include "utilities.h"
-#include "aarect.h"
-#include "hittable_list.h"
-
-// class material;
+#include "hittable.h"
+#include "material.h"
 
+// Axis-aligned box primitive intersected directly with a single slab test
+// Each face is parameterized like the matching axis-aligned rect: faces perpendicular to z
+// get (x, y) texture coordinates, faces perpendicular to y get (x, z) and faces perpendicular to x get (y, z)
 class box : public hittable
 {
 public:
     box() {}
-    box(const point3& p0, const point3& p1, shared_ptr<material> m_ptr);
+    box(const point3& p0, const point3& p1, shared_ptr<material> m_ptr) : box_min(p0), box_max(p1), mat(m_ptr) {}
+
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    // The axis of the face that was hit is kept as the record's primitive index
+    virtual void finalize(const ray& r, hit_record& rec) const override;
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        real t_near, t_far;
+        int near_axis, far_axis;
+        if(!slab_interval(r, t_near, t_far, near_axis, far_axis)) return false;
+
+        return (t_near >= t_min && t_near <= t_max) || (t_far >= t_min && t_far <= t_max);
+    }
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override 
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         output_box = aabb(box_min, box_max);
         return true;
     }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
 private:
+    // Intersects the ray with the three slabs of the box, giving the distances where it enters
+    // and leaves the box and the axes of the faces it crosses there
+    bool slab_interval(const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const;
+
     point3 box_min;
     point3 box_max;
-    hittable_list sides;
+    shared_ptr<material> mat;
 };
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> m_ptr)
+bool box::slab_interval(const ray& r, real& t_near, real& t_far, int& near_axis, int& far_axis) const
 {
-    box_min = p0;
-    box_max = p1;
+    // Branch-free per axis, since the signs of the direction are unpredictable across rays
+    real near_t[3], far_t[3];
+    for(int a = 0; a < 3; a++)
+    {
+        auto invD = 1.0 / r.direction()[a];
+        auto t0 = (box_min[a] - r.origin()[a]) * invD;
+        auto t1 = (box_max[a] - r.origin()[a]) * invD;
+        near_t[a] = std::min(t0, t1);
+        far_t[a] = std::max(t0, t1);
+    }
+
+    near_axis = near_t[0] > near_t[1] ? (near_t[0] > near_t[2] ? 0 : 2) : (near_t[1] > near_t[2] ? 1 : 2);
+    far_axis = far_t[0] < far_t[1] ? (far_t[0] < far_t[2] ? 0 : 2) : (far_t[1] < far_t[2] ? 1 : 2);
+    t_near = near_t[near_axis];
+    t_far = far_t[far_axis];
+
+    return t_near <= t_far;
+}
 
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), m_ptr)); 
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), m_ptr));
+bool box::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+    real t_near, t_far;
+    int near_axis, far_axis;
+    if(!slab_interval(r, t_near, t_far, near_axis, far_axis)) return false;
 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), m_ptr)); 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), m_ptr)); 
+    // The entry face is hit from outside the box, the exit face from inside it
+    real t;
+    int axis;
+    if(t_near >= t_min && t_near <= t_max)
+    {
+        t = t_near;
+        axis = near_axis;
+    }
+    else if(t_far >= t_min && t_far <= t_max)
+    {
+        t = t_far;
+        axis = far_axis;
+    }
+    else
+    {
+        return false;
+    }
 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), m_ptr)); 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), m_ptr)); 
+    rec.t = t;
+    rec.primitive = static_cast<uint32_t>(axis);
+    rec.object = this;
+    return true;
 }
 
-bool box::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+void box::finalize(const ray& r, hit_record& rec) const
 {
-    return sides.hit(r, t_min, t_max, rec);
+    const int axis = static_cast<int>(rec.primitive);
+    rec.p = r.at(rec.t);
+
+    if(needs_uv(mat.get()))
+    {
+        int u_axis = axis == 0 ? 1 : 0;
+        int v_axis = axis == 2 ? 1 : 2;
+        rec.u = (rec.p[u_axis] - box_min[u_axis]) / (box_max[u_axis] - box_min[u_axis]);
+        rec.v = (rec.p[v_axis] - box_min[v_axis]) / (box_max[v_axis] - box_min[v_axis]);
+    }
+
+    vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = rec.p[axis] < 0.5 * (box_min[axis] + box_max[axis]) ? -1 : 1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mat.get();
 }
 
 #endif
@@ -5,19 +5,39 @@
 #include "utilities.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "arena.h"
 
 class bvh_node : public hittable
 {
 public:
     bvh_node() {}
-    bvh_node(const hittable_list& list, double time0, double time1)
-    : bvh_node(list.obj(), 0, list.obj().size(), time0, time1) {}
+    // Inner nodes are made in {arena} if one is given
+    bvh_node(const hittable_list& list, real time0, real time1, scene_arena* arena=nullptr)
+    : bvh_node(list.obj(), 0, list.obj().size(), time0, time1, arena) {}
 
-    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1);
+    bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, size_t start, size_t end, real time0, real time1, scene_arena* arena=nullptr);
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    virtual void hit_packet(ray_packet& packet, uint32_t mask, real t_min) const override;
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override;
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override
+    {
+        left->collect_materials(materials);
+        if(right != left) right->collect_materials(materials);
+    }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override
+    {
+        left->collect_lights(lights);
+        if(right != left) right->collect_lights(lights);
+    }
+
+    virtual bool moves() const override { return left->moves() || right->moves(); }
 
 private:
     std::shared_ptr<hittable> left;
@@ -25,13 +45,13 @@ private:
     aabb box;
 };
 
-bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
+bool bvh_node::bounding_box(real time0, real time1, aabb& output_box) const
 {
     output_box = box;
     return true;
 }
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     if(!box.hit(r, t_min, t_max)) return false;
 
@@ -41,8 +61,40 @@ bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     return hit_left || hit_right;
 }
 
+// The right subtree is only visited if nothing in the left one blocks the ray
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const
+{
+    if(!box.hit(r, t_min, t_max)) return false;
+
+    return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
+// Each node is tested against the packet bounds first, then the rays are tested one by one only up to the
+// first that hits the box; the rest go down untested and get dropped further down if they miss
+// Once a single ray is left there is nothing to share, and it finishes the subtree on its own
+void bvh_node::hit_packet(ray_packet& packet, uint32_t mask, real t_min) const
+{
+    if(packet.coherent && !box.hit(packet.origin_min, packet.origin_max, packet.inv_dir_min, packet.inv_dir_max, t_min, packet.t_far)) return;
+
+    for(; mask; mask &= mask - 1)
+    {
+        auto i = first_ray(mask);
+        if(box.hit(packet.rays[i].origin(), packet.inv_dir[i], t_min, packet.t_max[i])) break;
+    }
+
+    if(mask == 0) return;
+    if((mask & (mask - 1)) == 0)
+    {
+        hittable::hit_packet(packet, mask, t_min);
+        return;
+    }
+
+    left->hit_packet(packet, mask, t_min);
+    right->hit_packet(packet, mask, t_min);
+}
+
 
-inline bool box_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b, int axis)
+inline bool box_compare(const std::shared_ptr<hittable>& a, const std::shared_ptr<hittable>& b, int axis)
 {
     aabb box_a;
     aabb box_b;
@@ -55,17 +107,17 @@ inline bool box_compare(const std::shared_ptr<hittable> a, const std::shared_ptr
     return box_a.min()[axis] < box_b.min()[axis];
 }
 
-bool box_x_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
+bool box_x_compare(const std::shared_ptr<hittable>& a, const std::shared_ptr<hittable>& b)
 {
     return box_compare(a, b, 0);
 }
 
-bool box_y_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
+bool box_y_compare(const std::shared_ptr<hittable>& a, const std::shared_ptr<hittable>& b)
 {
     return box_compare(a, b, 1);
 }
 
-bool box_z_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b)
+bool box_z_compare(const std::shared_ptr<hittable>& a, const std::shared_ptr<hittable>& b)
 {
     return box_compare(a, b, 2);
 }
@@ -73,9 +125,12 @@ bool box_z_compare(const std::shared_ptr<hittable> a, const std::shared_ptr<hitt
 
 
 
-bvh_node::bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, size_t start, size_t end, double time0, double time1)
+bvh_node::bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, size_t start, size_t end, real time0, real time1, scene_arena* arena)
 {
-    auto objects = src_objects;
+    // Only this node's objects are copied, which keeps building O(n log n)
+    std::vector<std::shared_ptr<hittable>> objects(src_objects.begin() + start, src_objects.begin() + end);
+    end -= start;
+    start = 0;
 
     int axis = random_int(0, 2);
     auto comparator = (axis == 0) ? box_x_compare
@@ -106,8 +161,8 @@ bvh_node::bvh_node(const std::vector<std::shared_ptr<hittable>>& src_objects, si
         std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
         auto mid = start + object_span / 2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+        left = arena ? arena->make<bvh_node>(objects, start, mid, time0, time1, arena) : make_shared<bvh_node>(objects, start, mid, time0, time1);
+        right = arena ? arena->make<bvh_node>(objects, mid, end, time0, time1, arena) : make_shared<bvh_node>(objects, mid, end, time0, time1);
     }
 
     aabb left_box, right_box;
@@ -10,12 +10,12 @@ public:
     camera( point3 look_from,
             point3 look_at,
             vec3 vup,
-            double vfov,
-            double ar,
-            double aperture, 
-            double focus_dist,
-            double tm0 = 0.0,
-            double tm1 = 0.0
+            real vfov,
+            real ar,
+            real aperture, 
+            real focus_dist,
+            real tm0 = 0.0,
+            real tm1 = 0.0
             ) : m_origin(look_from), time0(tm0), time1(tm1)
     {
         // Adjusts viewport parameters based on supplied field of view value
@@ -38,25 +38,41 @@ public:
         m_lens_radius = aperture / 2;
     }
 
-    ray get_ray(double s, double t)
+    ray get_ray(real s, real t) const
     {
-        // For Depth of Field effect
-        vec3 rd = m_lens_radius * random_in_unit_disk();
-        vec3 offset = u * rd.x() + v * rd.y();
+        if(has_depth_of_field()) return has_motion_blur() ? get_ray<true, true>(s, t) : get_ray<true, false>(s, t);
+        return has_motion_blur() ? get_ray<false, true>(s, t) : get_ray<false, false>(s, t);
+    }
+
+    // Ray for a camera whose features are known at compile time, used by render kernels that are specialized for them
+    // Without depth of field rays start at the camera's origin and without motion blur at the shutter's opening time,
+    // and neither takes random numbers
+    template<bool depth_of_field, bool motion_blur>
+    ray get_ray(real s, real t) const
+    {
+        vec3 offset(0, 0, 0);
+        if(depth_of_field)
+        {
+            vec3 rd = m_lens_radius * random_in_unit_disk();
+            offset = u * rd.x() + v * rd.y();
+        }
 
         return ray( m_origin + offset, 
                     m_lower_left_corner + s * m_horizontal + t * m_vertical   - m_origin - offset,
-                    random_double(time0, time1));
+                    motion_blur ? random_double(time0, time1) : time0);
     }
 
+    bool has_depth_of_field() const { return m_lens_radius > 0; }
+    bool has_motion_blur() const { return time1 > time0; }
+
 private:
      point3 m_origin;
      vec3 m_horizontal;
      vec3 m_vertical;
      point3 m_lower_left_corner;
      vec3 u, v, w;
-     double m_lens_radius;
-     double time0, time1;
+     real m_lens_radius;
+     real time0, time1;
 };
 
 #endif
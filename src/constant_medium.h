@@ -9,25 +9,30 @@
 class constant_medium : public hittable
 {
 public:
-    constant_medium(shared_ptr<hittable> b, double d, shared_ptr<texture> a)
+    constant_medium(shared_ptr<hittable> b, real d, shared_ptr<texture> a)
     : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<isotropic>(a)) {}
 
-    constant_medium(shared_ptr<hittable> b, double d, color c)
+    constant_medium(shared_ptr<hittable> b, real d, color c)
     : boundary(b), neg_inv_density(-1/d), phase_function(make_shared<isotropic>(c)) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override; 
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override; 
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         return boundary->bounding_box(time0, time1, output_box);
     }
+
+    // Hits inside the medium report the phase function, never the boundary's own material
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(phase_function.get()); }
+
+    virtual bool moves() const override { return boundary->moves(); }
 private:
     shared_ptr<hittable> boundary;
     shared_ptr<material> phase_function;
-    double neg_inv_density;
+    real neg_inv_density;
 };
 
-bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+bool constant_medium::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
 {
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
@@ -72,7 +77,8 @@ bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record&
 
     rec.normal = vec3(1, 0, 0);
     rec.front_face = true;
-    rec.mat_ptr = phase_function;
+    rec.mat_ptr = phase_function.get();
+    rec.object = nullptr;
 
     return true;
 }
@@ -2,19 +2,36 @@
 #define _HITTABLE_h
 
 #include <memory>
+#include <cstdint>
+#include <vector>
 #include "utilities.h"
 #include "aabb.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 // Struct to hold details of individual ray-object intersections
 struct hit_record
 {
     point3 p;
     vec3 normal;
-    double t;
-    double u;
-    double v;
+    real t;
+    real u;
+    real v;
     bool front_face;
-    std::shared_ptr<class material> mat_ptr;
+    // Not owning, the object that was hit keeps its material alive. A plain pointer keeps hits and
+    // copies of records free of reference count updates, which all threads would contend on
+    const class material* mat_ptr = nullptr;
+
+    // Primitives only record what finding the closest hit needs: t, themselves as {object}, an index {primitive}
+    // within them (such as a mesh's triangle) and coordinates {b1}, {b2} on it (such as barycentrics). The rest of
+    // the record is computed once, for the winning hit, by finalize_hit(). Objects that fill in the whole record
+    // in hit() set {object} to null, as the record may still hold one from an earlier candidate, or to themselves
+    // with a finalize() that does nothing
+    const class hittable* object = nullptr;
+    uint32_t primitive = 0;
+    real b1 = 0;
+    real b2 = 0;
 
     void set_face_normal(const ray& r, const vec3& outward_normal)
     {
@@ -23,136 +40,166 @@ struct hit_record
     }
 };
 
-// Abstract base class for objects that can be hit/intersected by a ray
-class hittable
+// Up to 16 rays traced through the scene together, such as camera rays for neighbouring pixels
+// Bit i of a mask selects rays[i]. Each ray keeps its own closest hit in recs[i] and t_max[i],
+// and hit_mask has the bits of the rays that hit something
+// If every ray's direction has the same signs, the packet is coherent and also keeps bounds on the
+// origins and reciprocal directions, so a box can be rejected for all of its rays with one test
+struct ray_packet
 {
-public:
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const=0;
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const=0;
-};
+    static constexpr int max_size = 16;
 
+    int size = 0;
+    ray rays[max_size];
+    vec3 inv_dir[max_size];
+    real t_max[max_size];
+    hit_record recs[max_size];
+    uint32_t hit_mask = 0;
 
+    bool coherent = false;
+    point3 origin_min, origin_max;
+    vec3 inv_dir_min, inv_dir_max;
+    real t_far = 0;
 
-class translate : public hittable
-{
-public:
-    translate(shared_ptr<hittable> m_ptr, const vec3& displacement) : ptr(m_ptr), offset(displacement) {}
+    void add(const ray& r, real t_max_ray)
+    {
+        rays[size] = r;
+        inv_dir[size] = 1.0 / r.direction();
+        t_max[size] = t_max_ray;
+        size++;
+    }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    // Computes the packet bounds, called once all rays have been added
+    void finish();
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+    // Packets are large, so loops reuse one rather than constructing a new one for every tile
+    void clear() { size = 0; }
 
-private:
-    shared_ptr<hittable> ptr;
-    vec3 offset;
+    uint32_t all() const { return (1u << size) - 1; }
 };
 
-bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+void ray_packet::finish()
 {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
-    if(!ptr->hit(moved_r, t_min, t_max, rec)) return false;
-
-    rec.p += offset;
-    rec.set_face_normal(moved_r, rec.normal);
+    hit_mask = 0;
+    coherent = size > 0;
+    if(!coherent) return;
+
+    origin_min = origin_max = rays[0].origin();
+    inv_dir_min = inv_dir_max = inv_dir[0];
+    t_far = t_max[0];
+    for(int i = 1; i < size; i++)
+    {
+        origin_min = component_min(origin_min, rays[i].origin());
+        origin_max = component_max(origin_max, rays[i].origin());
+        inv_dir_min = component_min(inv_dir_min, inv_dir[i]);
+        inv_dir_max = component_max(inv_dir_max, inv_dir[i]);
+        t_far = fmax(t_far, t_max[i]);
+    }
 
-    return true;
+    // Directions along a plane (infinite reciprocals) or on both sides of one break the interval test
+    for(int a = 0; a < 3; a++)
+    {
+        coherent = coherent && std::isfinite(inv_dir_min[a]) && std::isfinite(inv_dir_max[a])
+                            && (inv_dir_min[a] > 0 || inv_dir_max[a] < 0);
+    }
 }
 
-bool translate::bounding_box(double time0, double time1, aabb& output_box) const
+// Index of the lowest set bit of {mask}, which must not be 0
+inline int first_ray(uint32_t mask)
 {
-    if(!ptr->bounding_box(time0, time1, output_box)) return false;
-
-    output_box = aabb(output_box.min() + offset, output_box.max() + offset);
-    return true;
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
 }
 
+class material;
+class hittable;
 
-class rotate_y : public hittable
+// An object that direct light sampling aims at, the radiance it emits, and what light_list bounds it by:
+// its surface {area}, and the cone of its surface normals around {axis} with half angle {normal_angle}
+// (0 for flat lights, pi for spheres). Emitters light both sides of their surface
+struct scene_light
+{
+    const hittable* object;
+    color emission;
+    real area;
+    vec3 axis;
+    real normal_angle;
+};
+
+// Abstract base class for objects that can be hit/intersected by a ray
+class hittable
 {
 public:
-    rotate_y(shared_ptr<hittable> p, double angle);
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const=0;
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const=0;
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+    // Computes the point, normal, material and, if the material's texture needs them, the texture coordinates
+    // of a hit whose record this object's hit() left incomplete, for the same ray {r}
+    virtual void finalize(const ray& r, hit_record& rec) const {}
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    // Any-hit query for visibility tests (shadow rays, ambient occlusion)
+    // Returns as soon as anything blocks the ray in [t_min, t_max] and never fills a hit_record
+    // The default falls back to a full closest-hit query for objects that don't override it
+    virtual bool occluded(const ray& r, real t_min, real t_max) const
     {
-        output_box = bbox;
-        return hasbox;
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
     }
 
-private:
-    shared_ptr<hittable> ptr;
-    double sin_theta;
-    double cos_theta;
-    bool hasbox;
-    aabb bbox;
-};
+    // Sampling of the object as seen from {origin}, for objects that can be used as area lights
+    // pdf_value is the solid angle density of sampling {direction}, random returns the vector from {origin}
+    // to a random point on the object, so a shadow ray along it reaches the point at t = 1
+    // Objects that can't be sampled keep the defaults
+    virtual real pdf_value(const point3& origin, const vec3& direction) const
+    {
+        return 0.0;
+    }
 
-rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p)
-{
-    auto radians = degrees_to_radians(angle);
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
-    hasbox = ptr->bounding_box(0, 1, bbox);
+    virtual vec3 random(const point3& origin) const
+    {
+        return vec3(1, 0, 0);
+    }
+
+    // Adds the materials the object's hits can report to {materials}, duplicates included
+    // Used to build the scene's material_table, objects without materials keep the default
+    virtual void collect_materials(std::vector<const material*>& materials) const {}
 
-    point3 min(infinity, infinity, infinity);  
-    point3 max(-infinity, -infinity, -infinity);
+    // Adds the objects with an emissive material that implement the sampling functions above to {lights}
+    // Emitters that can't be sampled are left out, and rays only find them by hitting them
+    virtual void collect_lights(std::vector<scene_light>& lights) const {}
 
-    for(int i = 0; i < 2; i++)
+    // Whether the object is in different places at different times, without which rays' times don't matter
+    virtual bool moves() const { return false; }
+
+    // Closest-hit query for the rays of {packet} selected by {mask}, updating their records, which are left
+    // to be finalized like those of hit(). Objects without a packet traversal of their own trace the rays one at a time
+    virtual void hit_packet(ray_packet& packet, uint32_t mask, real t_min) const
     {
-        for(int j = 0; j < 2; j++)
+        for(; mask; mask &= mask - 1)
         {
-            for(int k = 0; k < 2; k++)
+            auto i = first_ray(mask);
+            if(hit(packet.rays[i], t_min, packet.t_max[i], packet.recs[i]))
             {
-                auto x = i*bbox.max().x() + (1-i)*bbox.min().x();
-                auto y = j*bbox.max().y() + (1-j)*bbox.min().y();
-                auto z = k*bbox.max().z() + (1-k)*bbox.min().z();
-
-                auto newx = cos_theta * x + sin_theta * z;
-                auto newz = -sin_theta * x + cos_theta * z;
-
-                vec3 tester(newx, y, newz);
-
-                for(int c= 0; c < 3; c++)
-                {
-                    min[c] = fmin(min[c], tester[c]);
-                    max[c] = fmax(max[c], tester[c]);
-                }
+                packet.t_max[i] = packet.recs[i].t;
+                packet.hit_mask |= 1u << i;
             }
         }
     }
+};
 
-    bbox = aabb(min, max);
-}
-
-bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const
+// Completes the record of the closest hit found for {r}, records that are already complete are left as they are
+inline void finalize_hit(const ray& r, hit_record& rec)
 {
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] = sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
-
-    ray rotated_r(origin, direction, r.time());
-
-    if(!ptr->hit(rotated_r, t_min, t_max, rec)) return false;
-
-    auto p = rec.p;
-    auto normal = rec.normal;
-
-    p[0] = cos_theta*rec.p[0] + sin_theta*rec.p[2]; 
-    p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2]; 
-
-    normal[0] = cos_theta*normal[0] + sin_theta*normal[2]; 
-    normal[2] = -sin_theta*normal[0] + cos_theta*normal[2]; 
-
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
+    if(!rec.object) return;
 
-    return true;
+    auto object = rec.object;
+    rec.object = nullptr;
+    object->finalize(r, rec);
 }
 
 #endif
@@ -13,8 +13,28 @@ public:
     hittable_list()=default;
     hittable_list(std::shared_ptr<hittable> h) { objects.push_back(h); }
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
-    virtual bool bounding_box(double tm0, double tm1, aabb& output_box) const override;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+    virtual bool bounding_box(real tm0, real tm1, aabb& output_box) const override;
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override
+    {
+        for(const auto& obj : objects) obj->collect_materials(materials);
+    }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override
+    {
+        for(const auto& obj : objects) obj->collect_lights(lights);
+    }
+
+    virtual bool moves() const override
+    {
+        for(const auto& obj : objects)
+        {
+            if(obj->moves()) return true;
+        }
+        return false;
+    }
 
     void clear() { objects.clear(); }
     void add(std::shared_ptr<hittable> h) { objects.push_back(h); }
@@ -24,10 +44,10 @@ private:
     std::vector<std::shared_ptr<hittable>> objects;
 };
 
-    bool hittable_list::hit(const ray&r, double t_min, double t_max, hit_record& rec) const
+    bool hittable_list::hit(const ray&r, real t_min, real t_max, hit_record& rec) const
     {
         bool hit_anything = false;
-        double closest_so_far = t_max;
+        real closest_so_far = t_max;
         hit_record temp_rec;
         for(const auto& obj : objects)
         {
@@ -42,7 +62,18 @@ private:
         return hit_anything;
     }
 
-bool hittable_list::bounding_box(double tm0, double tm1, aabb& output_box) const
+// Unlike hit(), any object blocking the ray is enough so the loop stops at the first one found
+bool hittable_list::occluded(const ray& r, real t_min, real t_max) const
+{
+    for(const auto& obj : objects)
+    {
+        if(obj->occluded(r, t_min, t_max)) return true;
+    }
+
+    return false;
+}
+
+bool hittable_list::bounding_box(real tm0, real tm1, aabb& output_box) const
 {
     if(objects.empty()) return false;
 
@@ -0,0 +1,264 @@
+#ifndef _LIGHT_LIST_h
+#define _LIGHT_LIST_h
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "utilities.h"
+#include "aabb.h"
+#include "hittable.h"
+
+// What a node of the light tree knows about the lights below it: the box around them, the cone around {axis}
+// with half angle {normal_angle} that holds their surface normals, and their total emitted {power}
+// The cone's cosine and sine are kept as well, so that importance() needs no trigonometric functions
+struct light_bounds
+{
+    aabb box;
+    vec3 axis;
+    real normal_angle = 0;
+    real cos_angle = 1, sin_angle = 0;
+    real power = 0;
+
+    void set_normal_angle(real angle)
+    {
+        normal_angle = angle;
+        cos_angle = cos(angle);
+        sin_angle = sin(angle);
+    }
+};
+
+// Bounds of both {a} and {b}. The cone is the smallest one around both cones, turned from a's axis towards b's
+inline light_bounds merge(const light_bounds& a, const light_bounds& b)
+{
+    light_bounds result;
+    result.box = surrounding_box(a.box, b.box);
+    result.power = a.power + b.power;
+    result.axis = a.axis;
+    result.set_normal_angle(pi);
+
+    real between = std::acos(clamp(dot(a.axis, b.axis), -1, 1));
+    if(std::min(between + b.normal_angle, pi) <= a.normal_angle)
+    {
+        result.set_normal_angle(a.normal_angle);
+    }
+    else if(std::min(between + a.normal_angle, pi) <= b.normal_angle)
+    {
+        result.axis = b.axis;
+        result.set_normal_angle(b.normal_angle);
+    }
+    else
+    {
+        real angle = (a.normal_angle + between + b.normal_angle) / 2;
+        auto rotation_axis = cross(a.axis, b.axis);
+        if(angle < pi && rotation_axis.length_squared() > 0)
+        {
+            // Rotating a's axis about the normal of the plane of both axes moves it towards b's
+            real turn = angle - a.normal_angle;
+            result.axis = cos(turn) * a.axis + sin(turn) * cross(unit_vector(rotation_axis), a.axis);
+            result.set_normal_angle(angle);
+        }
+    }
+    return result;
+}
+
+// Upper bound on how much light from {b} can reach {p}, up to a constant factor: the power over the distance squared,
+// times the cosine at the lights of the smallest angle there can be between a normal and the direction to {p}
+// Diffuse emitters give no light at 90 degrees or more, and light both sides, so directions against the cone count too
+// The distance is kept to at least the radius of the box, so points next to or inside it don't get an infinite bound
+inline real importance(const light_bounds& b, const point3& p)
+{
+    if(b.power <= 0) return 0;
+
+    vec3 to_point = p - 0.5 * (b.box.min() + b.box.max());
+    real distance_squared = to_point.length_squared();
+    real radius_squared = 0.25 * (b.box.max() - b.box.min()).length_squared();
+    if(distance_squared <= radius_squared) return b.power / radius_squared;
+
+    // Directions from points in the box's bounding sphere to p are within an angle of the one from its center
+    // whose sine is {sin_spread}. The angles are subtracted through the cosine and sine of their difference
+    auto cos_to_point = std::min(real(fabs(dot(b.axis, to_point)) / sqrt(distance_squared)), real(1));
+    real sin_to_point = std::sqrt(1 - cos_to_point * cos_to_point);
+    real sin_spread = std::sqrt(radius_squared / distance_squared);
+    real cos_spread = std::sqrt(1 - sin_spread * sin_spread);
+
+    // Cosine of the angle to p outside the cone, then outside the spread as well, 1 where there is none left
+    if(cos_to_point >= b.cos_angle) return b.power / distance_squared;
+    auto cos_outside = cos_to_point * b.cos_angle + sin_to_point * b.sin_angle;
+    auto sin_outside = sin_to_point * b.cos_angle - cos_to_point * b.sin_angle;
+    if(cos_outside >= cos_spread) return b.power / distance_squared;
+
+    auto cosine = cos_outside * cos_spread + sin_outside * sin_spread;
+    return cosine > 0 ? b.power * cosine / distance_squared : 0;
+}
+
+// The emitters of a scene that direct light sampling aims at, collected with hittable::collect_lights()
+// They are kept in a binary tree of light_bounds, built like primitive_bvh by splitting at the median along the
+// longest axis. A light is picked from a point by going down the tree and choosing each child in proportion to
+// its importance() there, so lights that are near, bright and facing the point are picked more often than the
+// rest, and a pick costs O(log n) in the number of lights
+// The same scene object has to be used for rendering, since hits are matched to lights by the object they report
+class light_list
+{
+public:
+    light_list(const hittable& scene);
+
+    bool empty() const { return m_lights.empty(); }
+    size_t size() const { return m_lights.size(); }
+
+    // Picks a light to sample from {p} and gives the probability it had of being picked
+    // Null if no light can reach {p}
+    const scene_light* sample(const point3& p, real& probability) const;
+
+    // Probability of sample() picking {object} from {p}, 0 for objects that aren't in the list
+    real probability(const point3& p, const hittable* object) const;
+
+    bool contains(const hittable* object) const { return object && m_index.count(object) > 0; }
+
+private:
+    // Nodes are stored depth first, so an inner node's left child comes right after it and {second} is the
+    // index of its right child. Leaves have the index of their light in {second} instead
+    struct node
+    {
+        light_bounds bounds;
+        uint32_t second = 0;
+        bool leaf = false;
+    };
+
+    struct build_ref
+    {
+        light_bounds bounds;
+        point3 centroid;
+        uint32_t light;
+    };
+
+    uint32_t build(std::vector<build_ref>& refs, size_t start, size_t end, uint64_t trail, int depth);
+
+    std::vector<scene_light> m_lights;
+    std::vector<node> m_nodes;
+    // The path from the root to each light's leaf, bit i set where it goes right at depth i
+    std::vector<uint64_t> m_trails;
+    std::unordered_map<const hittable*, uint32_t> m_index;
+};
+
+light_list::light_list(const hittable& scene)
+{
+    scene.collect_lights(m_lights);
+
+    std::vector<build_ref> refs;
+    for(uint32_t i = 0; i < m_lights.size(); i++)
+    {
+        const auto& light = m_lights[i];
+        build_ref ref;
+        if(!light.object->bounding_box(0, 1, ref.bounds.box))
+        {
+            std::cerr << "No bounding box in light_list constructor.\n";
+            continue;
+        }
+        m_index.emplace(light.object, i);
+
+        ref.bounds.axis = unit_vector(light.axis);
+        ref.bounds.set_normal_angle(light.normal_angle);
+        ref.bounds.power = light.area * (light.emission.x() + light.emission.y() + light.emission.z()) / 3;
+        ref.centroid = 0.5 * (ref.bounds.box.min() + ref.bounds.box.max());
+        ref.light = i;
+        refs.push_back(ref);
+    }
+
+    m_trails.resize(m_lights.size(), 0);
+    if(!refs.empty()) build(refs, 0, refs.size(), 0, 0);
+}
+
+uint32_t light_list::build(std::vector<build_ref>& refs, size_t start, size_t end, uint64_t trail, int depth)
+{
+    const auto node_index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(node());
+
+    if(end - start == 1)
+    {
+        m_nodes[node_index].bounds = refs[start].bounds;
+        m_nodes[node_index].second = refs[start].light;
+        m_nodes[node_index].leaf = true;
+        m_trails[refs[start].light] = trail;
+        return node_index;
+    }
+
+    point3 cmin = refs[start].centroid;
+    point3 cmax = cmin;
+    for(size_t i = start + 1; i < end; i++)
+    {
+        cmin = component_min(cmin, refs[i].centroid);
+        cmax = component_max(cmax, refs[i].centroid);
+    }
+
+    auto extent = cmax - cmin;
+    int axis = 0;
+    if(extent.y() > extent[axis]) axis = 1;
+    if(extent.z() > extent[axis]) axis = 2;
+
+    // The trail has a bit per level, which a median split only runs out of past 2^64 lights
+    size_t mid = start + (end - start) / 2;
+    std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+                     [&](const build_ref& a, const build_ref& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+    auto left = build(refs, start, mid, trail, depth + 1);
+    auto right = build(refs, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+
+    m_nodes[node_index].bounds = merge(m_nodes[left].bounds, m_nodes[right].bounds);
+    m_nodes[node_index].second = right;
+    return node_index;
+}
+
+const scene_light* light_list::sample(const point3& p, real& probability) const
+{
+    probability = 0;
+    if(m_nodes.empty()) return nullptr;
+
+    real pick_probability = 1;
+    uint32_t index = 0;
+    while(!m_nodes[index].leaf)
+    {
+        auto left = importance(m_nodes[index + 1].bounds, p);
+        auto right = importance(m_nodes[m_nodes[index].second].bounds, p);
+        if(left + right <= 0) return nullptr;
+
+        auto p_left = left / (left + right);
+        if(random_double() < p_left)
+        {
+            pick_probability *= p_left;
+            index = index + 1;
+        }
+        else
+        {
+            pick_probability *= 1 - p_left;
+            index = m_nodes[index].second;
+        }
+    }
+
+    probability = pick_probability;
+    return &m_lights[m_nodes[index].second];
+}
+
+// Follows the light's trail down the tree with the same choices sample() makes
+real light_list::probability(const point3& p, const hittable* object) const
+{
+    auto found = object ? m_index.find(object) : m_index.end();
+    if(found == m_index.end()) return 0;
+
+    auto trail = m_trails[found->second];
+    real probability = 1;
+    uint32_t index = 0;
+    while(!m_nodes[index].leaf)
+    {
+        auto left = importance(m_nodes[index + 1].bounds, p);
+        auto right = importance(m_nodes[m_nodes[index].second].bounds, p);
+        if(left + right <= 0) return 0;
+
+        auto p_left = left / (left + right);
+        probability *= trail & 1 ? 1 - p_left : p_left;
+        index = trail & 1 ? m_nodes[index].second : index + 1;
+        trail >>= 1;
+    }
+    return probability;
+}
+
+#endif
@@ -1,21 +1,176 @@
 #ifndef _MATERIAL_h
 #define _MATERIAL_h
 
+#include <cstdint>
+#include <algorithm>
 #include "utilities.h"
 #include "hittable.h"
 #include "texture.h"
+#include "onb.h"
+
+// Kinds of material that material_table evaluates itself, any other material is custom and called virtually
+enum class material_kind : uint8_t
+{
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    isotropic,
+    custom
+};
+
+// Flat description of a material, the form materials take in a material_table
+// {albedo} is the material's colour, or its texture's colour when that is a solid_color; other textures are kept in {tex}
+// {param} is the fuzziness of metals and the refractive index of dielectrics
+struct compact_material
+{
+    material_kind kind = material_kind::custom;
+    color albedo;
+    const texture* tex = nullptr;
+    real param = 0;
+    const class material* source = nullptr;
+};
+
+// A ray scattered by a material: the bounced ray, the {attenuation} the path's throughput is multiplied by
+// (BSDF times cosine over the density), and the solid angle density {pdf} the direction was picked with
+// {pdf} is 0 for scattering that evaluate() can't weigh against other sampling, which is specular reflection
+// and refraction and scattering in volumes
+struct scatter_record
+{
+    ray scattered;
+    color attenuation;
+    real pdf = 0;
+};
 
 // Base material class with virtual scatte functions for non-emmisive surfaces and emitted function for emissive surfaces
+// The classes are how scenes describe materials; for rendering they are compiled into a material_table
 class material
 {
 public:
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const=0;
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const=0;
     virtual color emitted() const
     {
         return color(0, 0, 0);
     }
+
+    // BSDF times cosine for light arriving from {direction}, and in {pdf} the density scatter() has of picking
+    // {direction}. Materials whose scatter() gives a pdf have to implement it
+    virtual color evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const
+    {
+        pdf = 0;
+        return color(0, 0, 0);
+    }
+
+    // Whether scattering reads the texture coordinates of hits, which are only computed for materials that do
+    virtual bool uses_uv() const { return true; }
+
+    // Description of the material for a material_table, materials that don't override it stay custom
+    virtual compact_material compile() const
+    {
+        return {material_kind::custom, color(0, 0, 0), nullptr, 0, this};
+    }
+
+    // Index of the material in the material_table last built over a scene using it
+    uint32_t table_id() const { return m_table_id; }
+
+private:
+    friend class material_table;
+    mutable uint32_t m_table_id = 0;
 };
 
+// Whether hits on a surface with material {mat} need texture coordinates, surfaces without a material never do
+inline bool needs_uv(const material* mat)
+{
+    return mat && mat->uses_uv();
+}
+
+// Adds {object} to {lights} if its material {mat} emits light, with the surface bounds described at scene_light
+inline void add_light(std::vector<scene_light>& lights, const hittable* object, const material* mat,
+                      real area, const vec3& axis, real normal_angle)
+{
+    if(!mat) return;
+
+    auto emission = mat->emitted();
+    if(emission.x() > 0 || emission.y() > 0 || emission.z() > 0) lights.push_back({object, emission, area, axis, normal_angle});
+}
+
+// Scattering models, shared by the material classes below and material_table so that both give the same result
+inline ray scattered_ray(const ray& r_in, const hit_record& rec, const vec3& direction)
+{
+    return ray(offset_ray_origin(rec.p, rec.normal, direction), direction, r_in.time());
+}
+
+// Cosine distributed direction around the normal, without rejection sampling
+inline vec3 lambertian_direction(const hit_record& rec)
+{
+    return onb(rec.normal).local(random_cosine_direction());
+}
+
+inline vec3 metal_direction(const ray& r_in, const hit_record& rec, real fuzziness)
+{
+    return reflect(rec.normal, r_in.direction()) + fuzziness * random_in_unit_sphere();
+}
+
+// Density over directions of lambertian_direction(), the cosine to the normal over pi
+inline real lambertian_pdf(const hit_record& rec, const vec3& direction)
+{
+    return std::max(dot(unit_vector(direction), rec.normal), real(0)) / pi;
+}
+
+// Density over directions of metal_direction(), which goes through a random point of a ball around the
+// reflection. The density of a direction is the volume of the ball along it, the segment from {t_near} to
+// {t_far} weighted by the distance squared, over the volume of the ball
+inline real metal_pdf(const ray& r_in, const hit_record& rec, const vec3& direction, real fuzziness)
+{
+    vec3 center = reflect(rec.normal, r_in.direction());
+    auto b = dot(unit_vector(direction), center);
+    auto discriminant = b * b - center.length_squared() + fuzziness * fuzziness;
+    if(discriminant <= 0) return 0;
+
+    real root = std::sqrt(discriminant);
+    real t_far = b + root;
+    real t_near = std::max(b - root, real(0));
+    if(t_far <= 0) return 0;
+
+    return (t_far * t_far * t_far - t_near * t_near * t_near) / (4 * pi * fuzziness * fuzziness * fuzziness);
+}
+
+// Schlick's approximation of the reflectance of a dielectric
+inline real reflectance(real cosine, real ref_idx)
+{
+    auto r0 = (1 - ref_idx) / (1 + ref_idx);
+    r0 *= r0;
+    return r0 + (1-r0)*pow(1 - cosine, 5);
+}
+
+inline vec3 dielectric_direction(const ray& r_in, const hit_record& rec, real refractive_index)
+{
+    real refraction_ratio = rec.front_face ? (1.0 / refractive_index) : refractive_index;
+
+    auto unit_v = unit_vector(r_in.direction());
+    auto cos_theta = dot(-unit_v, rec.normal);
+    auto sin_theta = sqrt(1.0 - cos_theta*cos_theta);
+    bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+
+    if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+    {
+        return reflect(rec.normal, r_in.direction());
+    }
+    return refract(rec.normal, r_in.direction(), refraction_ratio);
+}
+
+// Colour of {tex} at the hit point, or {albedo} for solid colours, which compile to no texture at all
+inline color albedo_at(const color& albedo, const texture* tex, const hit_record& rec)
+{
+    return tex ? tex->value(rec.u, rec.v, rec.p) : albedo;
+}
+
+inline compact_material compile_textured(material_kind kind, const shared_ptr<texture>& tex, const material* source)
+{
+    if(auto solid = dynamic_cast<const solid_color*>(tex.get())) return {kind, solid->color_value(), nullptr, 0, source};
+    return {kind, color(0, 0, 0), tex.get(), 0, source};
+}
+
 // Derived material class for diffuse/lambertian surfaces
 class lambertian : public material
 {
@@ -23,85 +178,96 @@ public:
     lambertian(color a) : m_albedo(make_shared<solid_color>(a)) {}
     lambertian(shared_ptr<texture> a) : m_albedo(a) {}
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const override;
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override;
+    virtual color evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const override;
+
+    virtual compact_material compile() const override
+    {
+        return compile_textured(material_kind::lambertian, m_albedo, this);
+    }
+
+    virtual bool uses_uv() const override { return m_albedo->uses_uv(); }
 
 private:
     shared_ptr<texture> m_albedo;
 };
 
-bool lambertian::scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const
+bool lambertian::scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
 {
-    vec3 scatter_direction = rec.normal + random_unit_vector();
-    if(scatter_direction.near_zero()) scatter_direction = rec.normal;
-
-    scattered = ray(rec.p, scatter_direction, r_in.time());
-    attenuation = m_albedo->value(rec.u, rec.v, rec.p);
+    srec.scattered = scattered_ray(r_in, rec, lambertian_direction(rec));
+    srec.attenuation = m_albedo->value(rec.u, rec.v, rec.p);
+    srec.pdf = lambertian_pdf(rec, srec.scattered.direction());
 
     return true;
 }
 
+color lambertian::evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const
+{
+    pdf = lambertian_pdf(rec, direction);
+    return m_albedo->value(rec.u, rec.v, rec.p) * pdf;
+}
+
 // Derived material class for metal/reflective surfaces
 class metal : public material
 {
 public:
-    metal(color a, double fuzz = 0) : m_albedo(a), m_fuzziness(fuzz) { m_fuzziness > 1 ? 1 : m_fuzziness; }
+    metal(color a, real fuzz = 0) : m_albedo(a), m_fuzziness(fuzz) { m_fuzziness > 1 ? 1 : m_fuzziness; }
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const override;
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override;
+    virtual color evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const override;
+
+    virtual compact_material compile() const override
+    {
+        return {material_kind::metal, m_albedo, nullptr, m_fuzziness, this};
+    }
+
+    virtual bool uses_uv() const override { return false; }
 
 private:
     color m_albedo;
-    double m_fuzziness;
+    real m_fuzziness;
 };
 
-bool metal::scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const
+bool metal::scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
 {
-    attenuation = m_albedo;
-    vec3 scatter_direction = reflect(rec.normal, r_in.direction());
-    scattered = ray(rec.p, scatter_direction + m_fuzziness * random_in_unit_sphere(), r_in.time());
+    srec.attenuation = m_albedo;
+    srec.scattered = scattered_ray(r_in, rec, metal_direction(r_in, rec, m_fuzziness));
+    srec.pdf = m_fuzziness > 0 ? metal_pdf(r_in, rec, srec.scattered.direction(), m_fuzziness) : 0;
+
+    return dot(srec.scattered.direction(), rec.normal) > 0;    
+}
 
-    return dot(scattered.direction(), rec.normal) > 0;    
+// Directions below the surface are absorbed
+color metal::evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const
+{
+    pdf = m_fuzziness > 0 && dot(direction, rec.normal) > 0 ? metal_pdf(r_in, rec, direction, m_fuzziness) : 0;
+    return m_albedo * pdf;
 }
 
 // Derived material class for dielectric/transparent surfaces (e.g. glass)
 class dielectric : public material
 {
 public:
-    dielectric(double ir = 1) : m_refractive_index(ir) {}
-
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const override;
+    dielectric(real ir = 1) : m_refractive_index(ir) {}
 
-private:
-    double m_refractive_index;
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override;
 
-    static double reflectance(double cosine, double ref_idx)
+    virtual compact_material compile() const override
     {
-        auto r0 = (1 - ref_idx) / (1 + ref_idx);
-        r0 *= r0;
-        return r0 + (1-r0)*pow(1 - cosine, 5);
+        return {material_kind::dielectric, color(1, 1, 1), nullptr, m_refractive_index, this};
     }
-};
 
-bool dielectric::scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const
-{
-    attenuation = color(1, 1, 1);
-    double refraction_ratio = rec.front_face ? (1.0 / m_refractive_index) : m_refractive_index;
-    
-    auto unit_v = unit_vector(r_in.direction());
-    auto cos_theta = dot(-unit_v, rec.normal);
-    auto sin_theta = sqrt(1.0 - cos_theta*cos_theta);
-    bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+    virtual bool uses_uv() const override { return false; }
 
-    vec3 direction;
-    if(cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-    {
-        direction = reflect(rec.normal, r_in.direction());
-    }
-    else
-    {
-        direction = refract(rec.normal, r_in.direction(), refraction_ratio);
-    }
+private:
+    real m_refractive_index;
+};
 
-    scattered = ray(rec.p, direction, r_in.time());
+bool dielectric::scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
+{
+    srec.attenuation = color(1, 1, 1);
+    srec.scattered = scattered_ray(r_in, rec, dielectric_direction(r_in, rec, m_refractive_index));
+    srec.pdf = 0;
     return true;    
 }
 
@@ -111,13 +277,20 @@ class diffuse_light : public material
 public:
     diffuse_light(color a) : m_albedo(a) {}
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const override
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
         return false;
     }
 
     virtual color emitted() const override { return m_albedo; }
 
+    virtual compact_material compile() const override
+    {
+        return {material_kind::diffuse_light, m_albedo, nullptr, 0, this};
+    }
+
+    virtual bool uses_uv() const override { return false; }
+
 private:
     color m_albedo;
 };
@@ -129,12 +302,21 @@ public:
     isotropic(color c) : albedo(make_shared<solid_color>(c)) {}
     isotropic(shared_ptr<texture> a) : albedo(a) {}
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, ray& scattered, color& attenuation) const override
+    virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
-        scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
+        srec.scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
+        srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
+        srec.pdf = 0;
         return true;
     }
+
+    virtual compact_material compile() const override
+    {
+        return compile_textured(material_kind::isotropic, albedo, this);
+    }
+
+    virtual bool uses_uv() const override { return albedo->uses_uv(); }
+
 private:
     shared_ptr<texture> albedo;
 };
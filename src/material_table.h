@@ -0,0 +1,156 @@
+#ifndef _MATERIAL_TABLE_h
+#define _MATERIAL_TABLE_h
+
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_set>
+#include "utilities.h"
+#include "hittable.h"
+#include "material.h"
+
+// The materials of a scene compiled into one array of compact_material, evaluated with a switch on the kind
+// instead of virtual scatter() and emitted() calls, and without a virtual texture lookup for solid colours
+// Ids are given out grouped by kind, so sorting hits by id also sorts them by kind and a batch of shading work
+// goes through the switch with predictable branches. Custom materials and materials the table wasn't built
+// over are still evaluated through their virtual functions, so every material works with it
+class material_table
+{
+public:
+    material_table(const hittable& scene);
+
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const;
+    color emitted(const hit_record& rec) const;
+
+    // The hit material's material::evaluate()
+    // Lambertian and metal scatter with an attenuation that doesn't depend on the direction, so the BSDF times
+    // cosine is the attenuation times the density
+    color evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const;
+
+    // Id of the material of a hit, from 0 to size() - 1, or size() for materials not in the table
+    uint32_t id(const material* mat) const
+    {
+        auto id = mat->table_id();
+        return id < m_materials.size() && m_materials[id].source == mat ? id : size();
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(m_materials.size()); }
+    const compact_material& operator[](uint32_t id) const { return m_materials[id]; }
+
+private:
+    // Classes derived from the built-in materials inherit their compile() but may behave differently,
+    // so only objects of exactly these classes are evaluated by the table
+    static bool built_in(const material* mat)
+    {
+        const auto& type = typeid(*mat);
+        return type == typeid(lambertian) || type == typeid(metal) || type == typeid(dielectric) ||
+               type == typeid(diffuse_light) || type == typeid(isotropic);
+    }
+
+    std::vector<compact_material> m_materials;
+};
+
+material_table::material_table(const hittable& scene)
+{
+    std::vector<const material*> materials;
+    scene.collect_materials(materials);
+
+    std::unordered_set<const material*> seen;
+    for(auto mat : materials)
+    {
+        if(!mat || !seen.insert(mat).second) continue;
+        m_materials.push_back(built_in(mat) ? mat->compile() : mat->material::compile());
+    }
+
+    std::stable_sort(m_materials.begin(), m_materials.end(), [](const compact_material& a, const compact_material& b)
+    {
+        return a.kind < b.kind;
+    });
+
+    for(uint32_t i = 0; i < m_materials.size(); i++) m_materials[i].source->m_table_id = i;
+}
+
+bool material_table::scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
+{
+    srec.pdf = 0;
+    auto mat_id = id(rec.mat_ptr);
+    if(mat_id == size()) return rec.mat_ptr->scatter(r_in, rec, srec);
+
+    const auto& m = m_materials[mat_id];
+    switch(m.kind)
+    {
+        case material_kind::lambertian:
+            srec.scattered = scattered_ray(r_in, rec, lambertian_direction(rec));
+            srec.attenuation = albedo_at(m.albedo, m.tex, rec);
+            srec.pdf = lambertian_pdf(rec, srec.scattered.direction());
+            return true;
+
+        case material_kind::metal:
+            srec.attenuation = m.albedo;
+            srec.scattered = scattered_ray(r_in, rec, metal_direction(r_in, rec, m.param));
+            if(m.param > 0) srec.pdf = metal_pdf(r_in, rec, srec.scattered.direction(), m.param);
+            return dot(srec.scattered.direction(), rec.normal) > 0;
+
+        case material_kind::dielectric:
+            srec.attenuation = m.albedo;
+            srec.scattered = scattered_ray(r_in, rec, dielectric_direction(r_in, rec, m.param));
+            return true;
+
+        case material_kind::diffuse_light:
+            return false;
+
+        case material_kind::isotropic:
+            srec.scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
+            srec.attenuation = albedo_at(m.albedo, m.tex, rec);
+            return true;
+
+        default:
+            return m.source->scatter(r_in, rec, srec);
+    }
+}
+
+color material_table::evaluate(const ray& r_in, const hit_record& rec, const vec3& direction, real& pdf) const
+{
+    pdf = 0;
+    auto mat_id = id(rec.mat_ptr);
+    if(mat_id == size()) return rec.mat_ptr->evaluate(r_in, rec, direction, pdf);
+
+    const auto& m = m_materials[mat_id];
+    switch(m.kind)
+    {
+        case material_kind::lambertian:
+            pdf = lambertian_pdf(rec, direction);
+            return albedo_at(m.albedo, m.tex, rec) * pdf;
+
+        case material_kind::metal:
+            if(m.param > 0 && dot(direction, rec.normal) > 0) pdf = metal_pdf(r_in, rec, direction, m.param);
+            return m.albedo * pdf;
+
+        case material_kind::custom:
+            return m.source->evaluate(r_in, rec, direction, pdf);
+
+        default:
+            return color(0, 0, 0);
+    }
+}
+
+color material_table::emitted(const hit_record& rec) const
+{
+    auto mat_id = id(rec.mat_ptr);
+    if(mat_id == size()) return rec.mat_ptr->emitted();
+
+    const auto& m = m_materials[mat_id];
+    switch(m.kind)
+    {
+        case material_kind::diffuse_light:
+            return m.albedo;
+
+        case material_kind::custom:
+            return m.source->emitted();
+
+        default:
+            return color(0, 0, 0);
+    }
+}
+
+#endif
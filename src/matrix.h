@@ -0,0 +1,133 @@
+#ifndef _MATRIX_h
+#define _MATRIX_h
+
+#include "utilities.h"
+
+// Affine transformation matrix, stored as the top three rows of a 4x4 matrix
+// (the bottom row is always 0 0 0 1). Points pick up the translation column, vectors don't
+class matrix34
+{
+public:
+    // Constructors
+    matrix34() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+    static matrix34 translation(const vec3& offset)
+    {
+        matrix34 result;
+        for(int i = 0; i < 3; i++) result.m[i][3] = offset[i];
+        return result;
+    }
+
+    static matrix34 scaling(const vec3& factors)
+    {
+        matrix34 result;
+        for(int i = 0; i < 3; i++) result.m[i][i] = factors[i];
+        return result;
+    }
+
+    // Rotations by {angle} degrees about the coordinate axes
+    static matrix34 rotation_x(real angle)
+    {
+        auto radians = degrees_to_radians(angle);
+        matrix34 result;
+        result.m[1][1] = cos(radians); result.m[1][2] = -sin(radians);
+        result.m[2][1] = sin(radians); result.m[2][2] = cos(radians);
+        return result;
+    }
+
+    static matrix34 rotation_y(real angle)
+    {
+        auto radians = degrees_to_radians(angle);
+        matrix34 result;
+        result.m[0][0] = cos(radians); result.m[0][2] = sin(radians);
+        result.m[2][0] = -sin(radians); result.m[2][2] = cos(radians);
+        return result;
+    }
+
+    static matrix34 rotation_z(real angle)
+    {
+        auto radians = degrees_to_radians(angle);
+        matrix34 result;
+        result.m[0][0] = cos(radians); result.m[0][1] = -sin(radians);
+        result.m[1][0] = sin(radians); result.m[1][1] = cos(radians);
+        return result;
+    }
+
+    real operator()(int row, int col) const { return m[row][col]; }
+
+    // Composition; (a * b) applies b first, then a
+    matrix34 operator*(const matrix34& other) const
+    {
+        matrix34 result;
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 4; j++)
+            {
+                result.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+            }
+            result.m[i][3] += m[i][3];
+        }
+        return result;
+    }
+
+    // Transformations
+    point3 transform_point(const point3& p) const
+    {
+        return point3(m[0][0] * p[0] + m[0][1] * p[1] + m[0][2] * p[2] + m[0][3],
+                      m[1][0] * p[0] + m[1][1] * p[1] + m[1][2] * p[2] + m[1][3],
+                      m[2][0] * p[0] + m[2][1] * p[1] + m[2][2] * p[2] + m[2][3]);
+    }
+
+    vec3 transform_vector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                    m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                    m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+    }
+
+    // Multiplies by the transpose of the linear part; called on the inverse matrix this
+    // carries normals along with a transformation, including non-uniform scaling
+    vec3 transform_normal_transposed(const vec3& n) const
+    {
+        return vec3(m[0][0] * n[0] + m[1][0] * n[1] + m[2][0] * n[2],
+                    m[0][1] * n[0] + m[1][1] * n[1] + m[2][1] * n[2],
+                    m[0][2] * n[0] + m[1][2] * n[1] + m[2][2] * n[2]);
+    }
+
+    // Determinant of the linear part, the factor the transformation scales volumes by
+    real determinant() const
+    {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             + m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    matrix34 inverse() const
+    {
+        // Inverse of the linear part from its adjugate, then the translation is undone in the new basis
+        auto c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        auto c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        auto c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        auto inv_det = 1.0 / determinant();
+
+        matrix34 result;
+        result.m[0][0] = c00 * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = c01 * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = c02 * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        auto offset = result.transform_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for(int i = 0; i < 3; i++) result.m[i][3] = -offset[i];
+        return result;
+    }
+
+private:
+    real m[3][4];
+};
+
+#endif
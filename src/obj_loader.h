@@ -0,0 +1,287 @@
+#ifndef _OBJ_LOADER_h
+#define _OBJ_LOADER_h
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "triangle_mesh.h"
+#include "thread_pool.h"
+
+// Attributes and faces parsed from one contiguous piece of an OBJ file
+// Face corners hold (position, uv, normal) indices. Positive OBJ indices are stored 0-based,
+// negative (relative) ones are stored as obj_relative_base + i where i is the position relative
+// to the start of this chunk, since the number of attributes in earlier chunks isn't known
+// until all of them are parsed
+struct obj_chunk
+{
+    std::vector<float> v, vt, vn;
+    std::vector<int64_t> corners;
+    bool has_vt_refs = false;
+    bool has_vn_refs = false;
+};
+
+const int64_t obj_missing_index = INT64_MIN;
+const int64_t obj_relative_base = -(int64_t(1) << 62);
+
+inline const char* obj_skip_space(const char* p, const char* end)
+{
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+inline const char* obj_parse_float(const char* p, const char* end, float& value)
+{
+    p = obj_skip_space(p, end);
+    if(p < end && *p == '+') p++;
+    auto res = std::from_chars(p, end, value);
+    if(res.ec != std::errc()) value = 0;
+    return res.ptr;
+}
+
+// Parses one index of a face corner and converts it to the chunk encoding described above
+inline const char* obj_parse_index(const char* p, const char* end, size_t local_count, int64_t& index)
+{
+    int64_t raw = 0;
+    auto res = std::from_chars(p, end, raw);
+    if(res.ec != std::errc() || raw == 0)
+    {
+        index = obj_missing_index;
+        return res.ptr;
+    }
+
+    index = raw > 0 ? raw - 1 : obj_relative_base + static_cast<int64_t>(local_count) + raw;
+    return res.ptr;
+}
+
+// Parses the complete lines in [begin, end); faces with more than three corners are triangulated as fans
+void parse_obj_chunk(const char* begin, const char* end, obj_chunk& chunk)
+{
+    std::vector<int64_t> face;
+    const char* p = begin;
+
+    while(p < end)
+    {
+        const char* line_end = p;
+        while(line_end < end && *line_end != '\n') line_end++;
+
+        p = obj_skip_space(p, line_end);
+        if(line_end - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            float x, y, z;
+            p = obj_parse_float(p + 1, line_end, x);
+            p = obj_parse_float(p, line_end, y);
+            p = obj_parse_float(p, line_end, z);
+            chunk.v.insert(chunk.v.end(), {x, y, z});
+        }
+        else if(line_end - p > 2 && p[0] == 'v' && p[1] == 't')
+        {
+            float u, v;
+            p = obj_parse_float(p + 2, line_end, u);
+            p = obj_parse_float(p, line_end, v);
+            chunk.vt.insert(chunk.vt.end(), {u, v});
+        }
+        else if(line_end - p > 2 && p[0] == 'v' && p[1] == 'n')
+        {
+            float x, y, z;
+            p = obj_parse_float(p + 2, line_end, x);
+            p = obj_parse_float(p, line_end, y);
+            p = obj_parse_float(p, line_end, z);
+            chunk.vn.insert(chunk.vn.end(), {x, y, z});
+        }
+        else if(line_end - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            face.clear();
+            p = obj_skip_space(p + 1, line_end);
+            while(p < line_end)
+            {
+                int64_t vi, ti = obj_missing_index, ni = obj_missing_index;
+                p = obj_parse_index(p, line_end, chunk.v.size() / 3, vi);
+                if(p < line_end && *p == '/')
+                {
+                    p++;
+                    if(p < line_end && *p != '/') p = obj_parse_index(p, line_end, chunk.vt.size() / 2, ti);
+                    if(p < line_end && *p == '/') p = obj_parse_index(p + 1, line_end, chunk.vn.size() / 3, ni);
+                }
+                if(vi == obj_missing_index) break;
+
+                chunk.has_vt_refs |= ti != obj_missing_index;
+                chunk.has_vn_refs |= ni != obj_missing_index;
+                face.insert(face.end(), {vi, ti, ni});
+
+                while(p < line_end && *p != ' ' && *p != '\t') p++;
+                p = obj_skip_space(p, line_end);
+            }
+
+            for(size_t k = 2; 3*k < face.size(); k++)
+            {
+                chunk.corners.insert(chunk.corners.end(), face.begin(), face.begin() + 3);
+                chunk.corners.insert(chunk.corners.end(), face.begin() + 3*(k-1), face.begin() + 3*(k+1));
+            }
+        }
+
+        p = line_end + 1;
+    }
+}
+
+
+// Streaming loader for Wavefront OBJ meshes (positions, texture coordinates, normals and polygonal faces)
+// The file is read in blocks; every block is cut at line boundaries into one piece per thread, and the pieces
+// are parsed in parallel on the thread pool (if given) and on the calling thread.
+// Materials, groups and other statements are ignored. On failure an empty mesh is returned
+shared_ptr<mesh_data> load_obj(const std::string& filename, thread_pool* pool = nullptr)
+{
+    auto mesh = make_shared<mesh_data>();
+
+    std::ifstream file(filename, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "ERROR: Could not load " + filename + ".\n";
+        return mesh;
+    }
+
+    const size_t block_size = 64 << 20;
+    const size_t pieces_per_block = pool ? pool->thread_count() + 1 : 1;
+
+    std::deque<obj_chunk> chunks;
+    std::string buffer;
+    size_t carried = 0;
+
+    while(file)
+    {
+        buffer.resize(carried + block_size);
+        file.read(&buffer[carried], block_size);
+        size_t filled = carried + static_cast<size_t>(file.gcount());
+
+        // Only whole lines are parsed; the tail of the block is carried over to the next one
+        size_t parse_end = filled;
+        if(file)
+        {
+            auto last_newline = buffer.rfind('\n', filled - 1);
+            parse_end = last_newline == std::string::npos ? 0 : last_newline + 1;
+        }
+
+        const char* data = buffer.data();
+        std::vector<std::future<void>> futures;
+        size_t piece_start = 0;
+        for(size_t i = 0; i < pieces_per_block && piece_start < parse_end; i++)
+        {
+            size_t piece_end = parse_end;
+            if(i + 1 < pieces_per_block)
+            {
+                // At least one byte per piece, so that blocks shorter than the piece count don't look before the buffer
+                piece_end = std::min(parse_end, piece_start + std::max(parse_end / pieces_per_block, size_t(1)));
+                while(piece_end < parse_end && data[piece_end - 1] != '\n') piece_end++;
+            }
+
+            chunks.emplace_back();
+            if(pool && piece_end < parse_end)
+            {
+                futures.push_back(pool->submit(parse_obj_chunk, data + piece_start, data + piece_end, std::ref(chunks.back())));
+            }
+            else
+            {
+                parse_obj_chunk(data + piece_start, data + piece_end, chunks.back());
+            }
+            piece_start = piece_end;
+        }
+
+        for(const auto& ft : futures)
+        {
+            ft.wait();
+        }
+
+        carried = filled - parse_end;
+        buffer.erase(0, parse_end);
+    }
+
+    // Merge the chunks in file order, resolving chunk relative indices against the attributes before them
+    size_t v_offset = 0, vt_offset = 0, vn_offset = 0;
+    bool has_uvs = false, has_normals = false;
+    for(const auto& chunk : chunks)
+    {
+        has_uvs |= chunk.has_vt_refs;
+        has_normals |= chunk.has_vn_refs;
+    }
+
+    // Index into the {count} attributes of a kind, or -1 when the corner has none or it is out of range
+    auto resolve = [](int64_t index, size_t offset, size_t count) -> int64_t
+    {
+        if(index == obj_missing_index) return -1;
+        auto resolved = index >= 0 ? index : static_cast<int64_t>(offset) + (index - obj_relative_base);
+        return resolved >= 0 && resolved < static_cast<int64_t>(count) ? resolved : -1;
+    };
+
+    size_t total_v = 0, total_vt = 0, total_vn = 0, total_corners = 0;
+    for(const auto& chunk : chunks)
+    {
+        total_v += chunk.v.size() / 3;
+        total_vt += chunk.vt.size() / 2;
+        total_vn += chunk.vn.size() / 3;
+        total_corners += chunk.corners.size() / 3;
+    }
+    has_uvs &= total_vt > 0;
+    has_normals &= total_vn > 0;
+
+    mesh->owned.px.reserve(total_v); mesh->owned.py.reserve(total_v); mesh->owned.pz.reserve(total_v);
+    mesh->owned.tu.reserve(total_vt); mesh->owned.tv.reserve(total_vt);
+    mesh->owned.nx.reserve(total_vn); mesh->owned.ny.reserve(total_vn); mesh->owned.nz.reserve(total_vn);
+    mesh->owned.indices.reserve(total_corners);
+    if(has_uvs) mesh->owned.uv_indices.reserve(total_corners);
+    if(has_normals) mesh->owned.normal_indices.reserve(total_corners);
+
+    size_t dropped = 0;
+    for(const auto& chunk : chunks)
+    {
+        for(size_t i = 0; i < chunk.v.size(); i += 3)
+        {
+            mesh->owned.px.push_back(chunk.v[i]);
+            mesh->owned.py.push_back(chunk.v[i+1]);
+            mesh->owned.pz.push_back(chunk.v[i+2]);
+        }
+        for(size_t i = 0; i < chunk.vt.size(); i += 2)
+        {
+            mesh->owned.tu.push_back(chunk.vt[i]);
+            mesh->owned.tv.push_back(chunk.vt[i+1]);
+        }
+        for(size_t i = 0; i < chunk.vn.size(); i += 3)
+        {
+            mesh->owned.nx.push_back(chunk.vn[i]);
+            mesh->owned.ny.push_back(chunk.vn[i+1]);
+            mesh->owned.nz.push_back(chunk.vn[i+2]);
+        }
+
+        // Triangles with a missing or out of range position are dropped, bad texture and normal indices use the first one
+        for(size_t i = 0; i < chunk.corners.size(); i += 9)
+        {
+            int64_t positions[3];
+            for(int k = 0; k < 3; k++) positions[k] = resolve(chunk.corners[i + 3*k], v_offset, total_v);
+            if(positions[0] < 0 || positions[1] < 0 || positions[2] < 0)
+            {
+                dropped++;
+                continue;
+            }
+
+            for(int k = 0; k < 3; k++)
+            {
+                mesh->owned.indices.push_back(static_cast<uint32_t>(positions[k]));
+                if(has_uvs) mesh->owned.uv_indices.push_back(static_cast<uint32_t>(std::max(resolve(chunk.corners[i + 3*k + 1], vt_offset, total_vt), int64_t(0))));
+                if(has_normals) mesh->owned.normal_indices.push_back(static_cast<uint32_t>(std::max(resolve(chunk.corners[i + 3*k + 2], vn_offset, total_vn), int64_t(0))));
+            }
+        }
+
+        v_offset += chunk.v.size() / 3;
+        vt_offset += chunk.vt.size() / 2;
+        vn_offset += chunk.vn.size() / 3;
+    }
+
+    mesh->bind_owned_buffers();
+    if(dropped > 0) std::cerr << "WARNING: " + filename + " has " << dropped << " triangles with vertex indices out of range, which were dropped.\n";
+
+    return mesh;
+}
+
+#endif
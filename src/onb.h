@@ -0,0 +1,30 @@
+#ifndef _ONB_h
+#define _ONB_h
+
+#include "utilities.h"
+
+// Orthonormal basis around a direction {w}, for turning directions sampled around the z axis into world space
+class onb
+{
+public:
+    onb(const vec3& w) : m_w(unit_vector(w))
+    {
+        // Any axis that isn't nearly parallel to w gives the other two
+        vec3 a = fabs(m_w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        m_v = unit_vector(cross(m_w, a));
+        m_u = cross(m_w, m_v);
+    }
+
+    const vec3& u() const { return m_u; }
+    const vec3& v() const { return m_v; }
+    const vec3& w() const { return m_w; }
+
+    // World space direction of the local direction (a, b, c)
+    vec3 local(real a, real b, real c) const { return a * m_u + b * m_v + c * m_w; }
+    vec3 local(const vec3& a) const { return local(a.x(), a.y(), a.z()); }
+
+private:
+    vec3 m_u, m_v, m_w;
+};
+
+#endif
@@ -27,7 +27,7 @@ public:
         delete[] perm_z;
     }
 
-    double noise(const point3& p) const 
+    real noise(const point3& p) const 
     {
         auto u = p.x() - floor(p.x());
         auto v = p.y() - floor(p.y());
@@ -52,7 +52,7 @@ public:
         return perlin_interp(c, u, v, w);
     }
 
-    double turb(const point3& p, int depth=7) const
+    real turb(const point3& p, int depth=7) const
     {
         auto accum = 0.0;
         auto temp_p = p;
@@ -75,7 +75,7 @@ private:
     int* perm_y;
     int* perm_z;
 
-    static double perlin_interp(vec3 c[2][2][2], double u, double v, double w)
+    static real perlin_interp(vec3 c[2][2][2], real u, real v, real w)
     {
         auto uu = u*u*(3-2*u);
         auto vv = v*v*(3-2*v);
@@ -98,7 +98,7 @@ private:
         return accum;
     }
 
-    static double trilinear_interp(double c[2][2][2], double u, double v, double w)
+    static real trilinear_interp(real c[2][2][2], real u, real v, real w)
     {
         auto accum = 0.0;
         for(int i = 0; i < 2; i++)
@@ -0,0 +1,480 @@
+#ifndef _PLY_LOADER_h
+#define _PLY_LOADER_h
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "triangle_mesh.h"
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file
+// Meshes loaded from the file keep the mapping alive through mesh_data::external
+class mapped_file
+{
+public:
+    mapped_file(const std::string& filename)
+    {
+#ifdef _WIN32
+        m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(m_file == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return;
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!m_mapping) return;
+
+        m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if(m_data) m_size = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0) return;
+
+        struct stat st;
+        if(fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(ptr != MAP_FAILED)
+            {
+                m_data = static_cast<const unsigned char*>(ptr);
+                m_size = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~mapped_file()
+    {
+#ifdef _WIN32
+        if(m_data) UnmapViewOfFile(m_data);
+        if(m_mapping) CloseHandle(m_mapping);
+        if(m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+        if(m_data) munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+    }
+
+    mapped_file(const mapped_file&)=delete;
+    mapped_file& operator=(const mapped_file&)=delete;
+
+    bool is_open() const { return m_data != nullptr; }
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const unsigned char* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+};
+
+
+// Resident set size of the process in bytes, or 0 where it can't be queried
+inline size_t resident_memory_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return counters.WorkingSetSize;
+    return 0;
+#else
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    if(!(statm >> total_pages >> resident_pages)) return 0;
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+
+// Layout of one PLY property; {size} is the size of a value (of the list items for lists)
+struct ply_property
+{
+    std::string name;
+    char kind = 'f';                // 'f' floating point, 'i' signed integer, 'u' unsigned integer
+    int size = 4;
+    bool is_list = false;
+    char count_kind = 'u';
+    int count_size = 1;
+    size_t offset = 0;              // Byte offset within the element, valid up to the first list
+};
+
+struct ply_element
+{
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property> properties;
+    const unsigned char* start = nullptr;
+
+    // Byte size of a record and the offset of a property, if no list comes before it
+    size_t fixed_stride() const
+    {
+        size_t stride = 0;
+        for(const auto& prop : properties) stride += prop.is_list ? 0 : prop.size;
+        return stride;
+    }
+
+    bool has_lists() const
+    {
+        for(const auto& prop : properties) if(prop.is_list) return true;
+        return false;
+    }
+
+    const ply_property* find(std::initializer_list<const char*> names) const
+    {
+        for(const auto& prop : properties)
+        {
+            for(auto name : names) if(prop.name == name) return &prop;
+        }
+        return nullptr;
+    }
+};
+
+inline bool ply_parse_type(const std::string& type, char& kind, int& size)
+{
+    if(type == "char" || type == "int8") { kind = 'i'; size = 1; }
+    else if(type == "uchar" || type == "uint8") { kind = 'u'; size = 1; }
+    else if(type == "short" || type == "int16") { kind = 'i'; size = 2; }
+    else if(type == "ushort" || type == "uint16") { kind = 'u'; size = 2; }
+    else if(type == "int" || type == "int32") { kind = 'i'; size = 4; }
+    else if(type == "uint" || type == "uint32") { kind = 'u'; size = 4; }
+    else if(type == "float" || type == "float32") { kind = 'f'; size = 4; }
+    else if(type == "double" || type == "float64") { kind = 'f'; size = 8; }
+    else return false;
+    return true;
+}
+
+// Reads one little-endian value of any PLY type as a double
+inline double ply_read(const unsigned char* p, char kind, int size)
+{
+    switch(size)
+    {
+    case 1: return kind == 'i' ? static_cast<double>(static_cast<int8_t>(*p)) : static_cast<double>(*p);
+    case 2: { uint16_t v; std::memcpy(&v, p, 2); return kind == 'i' ? static_cast<double>(static_cast<int16_t>(v)) : static_cast<double>(v); }
+    case 4:
+        if(kind == 'f') { float v; std::memcpy(&v, p, 4); return v; }
+        { uint32_t v; std::memcpy(&v, p, 4); return kind == 'i' ? static_cast<double>(static_cast<int32_t>(v)) : static_cast<double>(v); }
+    default: { double v; std::memcpy(&v, p, 8); return v; }
+    }
+}
+
+// Size in bytes of the record starting at {p}, walking over the lists in it
+// False if the record doesn't fit in the {available} bytes from {p}; no list count is read past them
+inline bool ply_record_size(const ply_element& element, const unsigned char* p, size_t available, size_t& size)
+{
+    size = 0;
+    for(const auto& prop : element.properties)
+    {
+        if(prop.is_list)
+        {
+            if(available - size < static_cast<size_t>(prop.count_size)) return false;
+            auto items = static_cast<size_t>(ply_read(p + size, prop.count_kind, prop.count_size));
+            size += prop.count_size;
+            if(items > (available - size) / prop.size) return false;
+            size += items * prop.size;
+        }
+        else
+        {
+            if(available - size < static_cast<size_t>(prop.size)) return false;
+            size += prop.size;
+        }
+    }
+    return true;
+}
+
+
+// Loader for binary little-endian PLY meshes
+// The file is memory-mapped and vertex attributes and face indices are used in place whenever their
+// layout matches the mesh's buffer views: 32-bit float components and triangles with 32-bit indices.
+// Only attributes in another layout are converted into owned buffers (e.g. double precision positions,
+// 16-bit indices or polygons, which are triangulated as fans). Load time and resident memory are
+// reported on std::cerr. On failure an empty mesh is returned
+shared_ptr<mesh_data> load_ply(const std::string& filename)
+{
+    auto t1 = std::chrono::high_resolution_clock::now();
+    auto mesh = make_shared<mesh_data>();
+
+    auto file = make_shared<mapped_file>(filename);
+    if(!file->is_open())
+    {
+        std::cerr << "ERROR: Could not load " + filename + ".\n";
+        return mesh;
+    }
+
+    const uint16_t endian_test = 1;
+    const bool little_endian_host = *reinterpret_cast<const unsigned char*>(&endian_test) == 1;
+
+    // Header
+    const char* text = reinterpret_cast<const char*>(file->data());
+    const char* header_end = nullptr;
+    const char* marker = "end_header";
+    for(size_t i = 0; i + 10 <= file->size() && i < (1 << 20); i++)
+    {
+        if(std::memcmp(text + i, marker, 10) == 0)
+        {
+            header_end = text + i + 10;
+            break;
+        }
+    }
+    if(!header_end || std::strncmp(text, "ply", 3) != 0)
+    {
+        std::cerr << "ERROR: " + filename + " is not a PLY file.\n";
+        return mesh;
+    }
+    while(header_end < text + file->size() && *header_end != '\n') header_end++;
+    header_end++;
+
+    std::vector<ply_element> elements;
+    std::istringstream header(std::string(text, header_end));
+    std::string line;
+    bool binary_le = false;
+    while(std::getline(header, line))
+    {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if(keyword == "format")
+        {
+            std::string format;
+            words >> format;
+            binary_le = format == "binary_little_endian";
+        }
+        else if(keyword == "element")
+        {
+            elements.emplace_back();
+            words >> elements.back().name >> elements.back().count;
+        }
+        else if(keyword == "property" && !elements.empty())
+        {
+            ply_property prop;
+            std::string type;
+            words >> type;
+            bool valid = true;
+            if(type == "list")
+            {
+                std::string count_type, item_type;
+                words >> count_type >> item_type;
+                prop.is_list = true;
+                valid = ply_parse_type(count_type, prop.count_kind, prop.count_size) && ply_parse_type(item_type, prop.kind, prop.size);
+            }
+            else
+            {
+                valid = ply_parse_type(type, prop.kind, prop.size);
+            }
+            words >> prop.name;
+
+            if(!valid)
+            {
+                std::cerr << "ERROR: Unsupported property type in " + filename + ".\n";
+                return mesh;
+            }
+
+            auto& props = elements.back().properties;
+            prop.offset = props.empty() ? 0 : props.back().offset + (props.back().is_list ? 0 : props.back().size);
+            props.push_back(prop);
+        }
+    }
+
+    if(!binary_le || !little_endian_host)
+    {
+        std::cerr << "ERROR: Only binary little-endian PLY files are supported (" + filename + ").\n";
+        return mesh;
+    }
+
+    // Locate the data of every element; only elements with lists need walking record by record
+    const unsigned char* cursor = reinterpret_cast<const unsigned char*>(header_end);
+    const unsigned char* file_end = file->data() + file->size();
+    ply_element* vertices = nullptr;
+    ply_element* faces = nullptr;
+    for(auto& element : elements)
+    {
+        element.start = cursor;
+        if(element.name == "vertex") vertices = &element;
+        if(element.name == "face") faces = &element;
+
+        // Every record has to be in the file, checked against the bytes left so that the cursor never passes the end
+        bool complete = true;
+        if(!element.has_lists())
+        {
+            const size_t stride = element.fixed_stride();
+            complete = stride == 0 || element.count <= static_cast<size_t>(file_end - cursor) / stride;
+            if(complete) cursor += element.count * stride;
+        }
+        else
+        {
+            for(size_t i = 0; i < element.count && complete; i++)
+            {
+                size_t size;
+                complete = ply_record_size(element, cursor, static_cast<size_t>(file_end - cursor), size);
+                if(complete) cursor += size;
+            }
+        }
+
+        if(!complete)
+        {
+            std::cerr << "ERROR: " + filename + " is truncated.\n";
+            return mesh;
+        }
+    }
+
+    const ply_property* x = vertices ? vertices->find({"x"}) : nullptr;
+    const ply_property* y = vertices ? vertices->find({"y"}) : nullptr;
+    const ply_property* z = vertices ? vertices->find({"z"}) : nullptr;
+    const ply_property* face_indices = faces ? faces->find({"vertex_indices", "vertex_index"}) : nullptr;
+    if(!x || !y || !z || !face_indices || !face_indices->is_list || vertices->has_lists())
+    {
+        std::cerr << "ERROR: " + filename + " has no vertex positions or faces.\n";
+        return mesh;
+    }
+
+    // Vertex attributes: views into the file for 32-bit floats, converted copies otherwise
+    const size_t vertex_stride = vertices->fixed_stride();
+    const size_t vertex_count = vertices->count;
+    bool all_attributes_mapped = true;
+    bool any_attribute_mapped = false;
+    auto bind = [&](const ply_property* prop, buffer_view<float>& view, std::vector<float>& storage)
+    {
+        if(prop->kind == 'f' && prop->size == 4)
+        {
+            view = buffer_view<float>(vertices->start + prop->offset, vertex_stride, vertex_count);
+            any_attribute_mapped = true;
+            return;
+        }
+
+        all_attributes_mapped = false;
+        storage.resize(vertex_count);
+        for(size_t i = 0; i < vertex_count; i++)
+        {
+            storage[i] = static_cast<float>(ply_read(vertices->start + i * vertex_stride + prop->offset, prop->kind, prop->size));
+        }
+        view = storage;
+    };
+
+    bind(x, mesh->px, mesh->owned.px);
+    bind(y, mesh->py, mesh->owned.py);
+    bind(z, mesh->pz, mesh->owned.pz);
+
+    const ply_property* nx = vertices->find({"nx"});
+    const ply_property* ny = vertices->find({"ny"});
+    const ply_property* nz = vertices->find({"nz"});
+    bool has_normals = nx && ny && nz;
+    if(has_normals)
+    {
+        bind(nx, mesh->nx, mesh->owned.nx);
+        bind(ny, mesh->ny, mesh->owned.ny);
+        bind(nz, mesh->nz, mesh->owned.nz);
+    }
+
+    const ply_property* tu = vertices->find({"u", "s", "texture_u", "texture_s"});
+    const ply_property* tv = vertices->find({"v", "t", "texture_v", "texture_t"});
+    bool has_uvs = tu && tv;
+    if(has_uvs)
+    {
+        bind(tu, mesh->tu, mesh->owned.tu);
+        bind(tv, mesh->tv, mesh->owned.tv);
+    }
+
+    // Faces: a view into the file when every face is a triangle with 32-bit indices and the index list is
+    // the only list of the element, so that all face records have the same size; converted otherwise
+    // Faces with indices outside the vertex list are dropped, which only conversion can do
+    auto valid_index = [&](double index) { return index >= 0 && index < static_cast<double>(vertex_count); };
+
+    size_t list_count = 0;
+    for(const auto& prop : faces->properties) list_count += prop.is_list ? 1 : 0;
+
+    bool indices_mapped = list_count == 1 && face_indices->kind != 'f' && face_indices->size == 4;
+    const size_t face_stride = faces->fixed_stride() + face_indices->count_size + 3 * face_indices->size;
+    for(size_t f = 0; f < faces->count && indices_mapped; f++)
+    {
+        const unsigned char* count = faces->start + f * face_stride + face_indices->offset;
+        indices_mapped = ply_read(count, face_indices->count_kind, face_indices->count_size) == 3;
+        for(int k = 0; k < 3 && indices_mapped; k++)
+        {
+            indices_mapped = valid_index(ply_read(count + face_indices->count_size + k * face_indices->size, face_indices->kind, face_indices->size));
+        }
+    }
+
+    if(indices_mapped)
+    {
+        mesh->indices = triangle_index_view(faces->start + face_indices->offset + face_indices->count_size, face_stride, faces->count);
+    }
+    else
+    {
+        size_t dropped = 0;
+        const unsigned char* p = faces->start;
+        for(size_t f = 0; f < faces->count; f++)
+        {
+            std::vector<uint32_t> polygon;
+            bool valid = true;
+            for(const auto& prop : faces->properties)
+            {
+                if(prop.is_list)
+                {
+                    auto items = static_cast<size_t>(ply_read(p, prop.count_kind, prop.count_size));
+                    p += prop.count_size;
+                    if(&prop == face_indices)
+                    {
+                        for(size_t i = 0; i < items; i++)
+                        {
+                            auto index = ply_read(p + i * prop.size, prop.kind, prop.size);
+                            valid = valid && valid_index(index);
+                            polygon.push_back(valid ? static_cast<uint32_t>(index) : 0);
+                        }
+                    }
+                    p += items * prop.size;
+                }
+                else
+                {
+                    p += prop.size;
+                }
+            }
+
+            if(!valid)
+            {
+                dropped++;
+                continue;
+            }
+
+            for(size_t k = 2; k < polygon.size(); k++)
+            {
+                mesh->owned.indices.insert(mesh->owned.indices.end(), {polygon[0], polygon[k-1], polygon[k]});
+            }
+        }
+        mesh->indices = mesh->owned.indices;
+
+        if(dropped > 0) std::cerr << "WARNING: " + filename + " has " << dropped << " faces with vertex indices out of range, which were dropped.\n";
+    }
+
+    if(has_normals) mesh->normal_indices = mesh->indices;
+    if(has_uvs) mesh->uv_indices = mesh->indices;
+
+    // The mapping is only kept when some buffer still points into it
+    if(any_attribute_mapped || indices_mapped) mesh->external = file;
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::stringstream log;
+    log << "Loaded " << filename << ": " << mesh->vertex_count() << " vertices, " << mesh->triangle_count() << " triangles in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " ms"
+        << " (vertices " << (all_attributes_mapped ? "mapped" : "converted")
+        << ", indices " << (indices_mapped ? "mapped" : "converted") << ")"
+        << ", resident memory " << resident_memory_bytes() / (1024 * 1024) << " MB\n";
+    std::cerr << log.str();
+
+    return mesh;
+}
+
+#endif
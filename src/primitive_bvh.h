@@ -0,0 +1,426 @@
+#ifndef _PRIMITIVE_BVH_h
+#define _PRIMITIVE_BVH_h
+
+#include <algorithm>
+#include <iostream>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "utilities.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "moving_sphere.h"
+#include "quad.h"
+#include "box.h"
+#include "aarect.h"
+
+// Wrapper for objects of any other type, which are intersected through their virtual functions
+struct virtual_primitive
+{
+    std::shared_ptr<hittable> object;
+
+    bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const { return object->hit(r, t_min, t_max, rec); }
+    bool occluded(const ray& r, real t_min, real t_max) const { return object->occluded(r, t_min, t_max); }
+    void collect_materials(std::vector<const material*>& materials) const { object->collect_materials(materials); }
+    void collect_lights(std::vector<scene_light>& lights) const { object->collect_lights(lights); }
+    bool moves() const { return object->moves(); }
+};
+
+// Scene BVH over primitives grouped by type, as an alternative to bvh_node that avoids a virtual call per node and per primitive
+// The objects of a hittable_list are copied into one array per concrete type, and every leaf of the flattened tree holds
+// primitives of a single type, so it is just a type tag and a range in that type's array. Leaves are intersected by a
+// switch on the tag and a loop whose intersection code is inlined. Objects of other types, including classes derived from
+// the ones below and instances, transforms and meshes, are kept in the last array and called virtually
+class primitive_bvh : public hittable
+{
+public:
+    using primitive_arrays = std::tuple<std::vector<sphere>,
+                                        std::vector<moving_sphere>,
+                                        std::vector<quad>,
+                                        std::vector<box>,
+                                        std::vector<xy_rect>,
+                                        std::vector<xz_rect>,
+                                        std::vector<yz_rect>,
+                                        std::vector<virtual_primitive>>;
+
+    static constexpr uint8_t type_count = std::tuple_size<primitive_arrays>::value;
+
+    primitive_bvh(const hittable_list& list, real time0, real time1);
+
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override
+    {
+        return traverse<false>(r, t_min, t_max, rec, 0);
+    }
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        hit_record rec;
+        return traverse<true>(r, t_min, t_max, rec, 0);
+    }
+
+    virtual void hit_packet(ray_packet& packet, uint32_t mask, real t_min) const override;
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
+    {
+        if(m_nodes.empty()) return false;
+
+        output_box = m_nodes[0].box;
+        return true;
+    }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override
+    {
+        for(uint8_t type = 0; type < type_count; type++)
+        {
+            visit(m_primitives, type, [&](const auto& primitives)
+            {
+                for(const auto& p : primitives) p.collect_materials(materials);
+            });
+        }
+    }
+
+    // The lights are the copies in the arrays, which are what hits report
+    virtual void collect_lights(std::vector<scene_light>& lights) const override
+    {
+        for(uint8_t type = 0; type < type_count; type++)
+        {
+            visit(m_primitives, type, [&](const auto& primitives)
+            {
+                for(const auto& p : primitives) p.collect_lights(lights);
+            });
+        }
+    }
+
+    virtual bool moves() const override
+    {
+        bool any = false;
+        for(uint8_t type = 0; type < type_count; type++)
+        {
+            visit(m_primitives, type, [&](const auto& primitives)
+            {
+                for(const auto& p : primitives) any = any || p.moves();
+            });
+        }
+        return any;
+    }
+
+    // Number of primitives stored with the given type tag (an index into primitive_arrays)
+    size_t primitive_count(uint8_t type) const
+    {
+        size_t count = 0;
+        visit(m_primitives, type, [&](const auto& primitives) { count = primitives.size(); });
+        return count;
+    }
+
+private:
+    // Interior nodes store their left child right after themselves and the right child at {first}
+    // Leaves store {count} primitives of type {type} starting at {first} in that type's array
+    struct node
+    {
+        aabb box;
+        uint32_t first;
+        uint16_t count;
+        uint8_t type;
+        uint8_t axis;
+    };
+
+    struct build_ref
+    {
+        uint8_t type;
+        uint32_t index;
+        aabb box;
+        point3 centroid;
+    };
+
+    static const int max_leaf_primitives = 4;
+
+    // Calls {f} with the array for {type}
+    template<typename Arrays, typename F>
+    static void visit(Arrays& arrays, uint8_t type, F&& f);
+
+    template<uint8_t I=0>
+    static uint8_t type_of(const hittable& object);
+
+    uint32_t build(std::vector<build_ref>& refs, const primitive_arrays& input, size_t start, size_t end);
+
+    template<bool any_hit>
+    bool hit_leaf(const node& n, const ray& r, real t_min, real& t_max, hit_record& rec) const;
+
+    template<bool any_hit>
+    bool traverse(const ray& r, real t_min, real t_max, hit_record& rec, uint32_t root) const;
+
+    std::vector<node> m_nodes;
+    primitive_arrays m_primitives;
+};
+
+template<typename Arrays, typename F>
+void primitive_bvh::visit(Arrays& arrays, uint8_t type, F&& f)
+{
+    static_assert(std::tuple_size<typename std::remove_const<Arrays>::type>::value == 8, "visit() needs a case for every primitive type");
+    switch(type)
+    {
+    case 0: f(std::get<0>(arrays)); break;
+    case 1: f(std::get<1>(arrays)); break;
+    case 2: f(std::get<2>(arrays)); break;
+    case 3: f(std::get<3>(arrays)); break;
+    case 4: f(std::get<4>(arrays)); break;
+    case 5: f(std::get<5>(arrays)); break;
+    case 6: f(std::get<6>(arrays)); break;
+    default: f(std::get<7>(arrays)); break;
+    }
+}
+
+// Only exact type matches get a typed array, so overrides in derived classes are respected
+template<uint8_t I>
+uint8_t primitive_bvh::type_of(const hittable& object)
+{
+    if constexpr(I + 1 == type_count)
+    {
+        return I;
+    }
+    else
+    {
+        using T = typename std::tuple_element<I, primitive_arrays>::type::value_type;
+        return typeid(object) == typeid(T) ? I : type_of<I + 1>(object);
+    }
+}
+
+template<typename T>
+T copy_primitive(const std::shared_ptr<hittable>& object)
+{
+    return static_cast<const T&>(*object);
+}
+
+template<>
+virtual_primitive copy_primitive<virtual_primitive>(const std::shared_ptr<hittable>& object)
+{
+    return virtual_primitive{object};
+}
+
+primitive_bvh::primitive_bvh(const hittable_list& list, real time0, real time1)
+{
+    primitive_arrays input;
+    std::vector<build_ref> refs;
+    for(const auto& object : list.obj())
+    {
+        build_ref ref;
+        if(!object->bounding_box(time0, time1, ref.box))
+        {
+            std::cerr << "No bounding box in primitive_bvh constructor.\n";
+            continue;
+        }
+        ref.centroid = 0.5 * (ref.box.min() + ref.box.max());
+        ref.type = type_of(*object);
+        visit(input, ref.type, [&](auto& primitives)
+        {
+            using T = typename std::decay<decltype(primitives)>::type::value_type;
+            ref.index = static_cast<uint32_t>(primitives.size());
+            primitives.push_back(copy_primitive<T>(object));
+        });
+        refs.push_back(ref);
+    }
+
+    if(!refs.empty()) build(refs, input, 0, refs.size());
+}
+
+uint32_t primitive_bvh::build(std::vector<build_ref>& refs, const primitive_arrays& input, size_t start, size_t end)
+{
+    const auto node_index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(node());
+
+    aabb bounds = refs[start].box;
+    point3 cmin = refs[start].centroid;
+    point3 cmax = cmin;
+    bool single_type = true;
+    for(size_t i = start + 1; i < end; i++)
+    {
+        bounds = surrounding_box(bounds, refs[i].box);
+        cmin = component_min(cmin, refs[i].centroid);
+        cmax = component_max(cmax, refs[i].centroid);
+        single_type = single_type && refs[i].type == refs[start].type;
+    }
+    m_nodes[node_index].box = bounds;
+
+    auto extent = cmax - cmin;
+    int axis = 0;
+    if(extent.y() > extent[axis]) axis = 1;
+    if(extent.z() > extent[axis]) axis = 2;
+
+    // Primitives with coincident centroids can't be split any further, so they share a leaf
+    bool small = end - start <= max_leaf_primitives || extent[axis] <= 0;
+    if(small && single_type && end - start <= UINT16_MAX)
+    {
+        auto& n = m_nodes[node_index];
+        n.type = refs[start].type;
+        n.count = static_cast<uint16_t>(end - start);
+        visit(m_primitives, n.type, [&](auto& primitives)
+        {
+            using array = typename std::decay<decltype(primitives)>::type;
+            const auto& source = std::get<array>(input);
+            n.first = static_cast<uint32_t>(primitives.size());
+            for(size_t i = start; i < end; i++) primitives.push_back(source[refs[i].index]);
+        });
+        return node_index;
+    }
+
+    size_t mid;
+    if(small)
+    {
+        // Leaves hold a single type, so small nodes of mixed types are split by type instead
+        auto first_type = refs[start].type;
+        mid = std::stable_partition(refs.begin() + start, refs.begin() + end, [&](const build_ref& ref) { return ref.type == first_type; }) - refs.begin();
+        if(mid == end) mid = start + (end - start) / 2;
+    }
+    else
+    {
+        mid = start + (end - start) / 2;
+        std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+                         [&](const build_ref& a, const build_ref& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    build(refs, input, start, mid);
+    auto right = build(refs, input, mid, end);
+
+    m_nodes[node_index].first = right;
+    m_nodes[node_index].count = 0;
+    m_nodes[node_index].axis = static_cast<uint8_t>(axis);
+    return node_index;
+}
+
+// The qualified calls bind statically, so each case of the switch gets its own loop with the intersection inlined
+template<bool any_hit>
+bool primitive_bvh::hit_leaf(const node& n, const ray& r, real t_min, real& t_max, hit_record& rec) const
+{
+    bool hit_anything = false;
+    visit(m_primitives, n.type, [&](const auto& primitives)
+    {
+        using T = typename std::decay<decltype(primitives)>::type::value_type;
+        for(uint32_t i = n.first; i < n.first + n.count; i++)
+        {
+            if(any_hit)
+            {
+                if(primitives[i].T::occluded(r, t_min, t_max))
+                {
+                    hit_anything = true;
+                    return;
+                }
+            }
+            else if(primitives[i].T::hit(r, t_min, t_max, rec))
+            {
+                hit_anything = true;
+                t_max = rec.t;
+            }
+        }
+    });
+    return hit_anything;
+}
+
+// Iterative front-to-back traversal from node {root}, shared by the closest-hit and any-hit queries
+template<bool any_hit>
+bool primitive_bvh::traverse(const ray& r, real t_min, real t_max, hit_record& rec, uint32_t root) const
+{
+    if(m_nodes.empty()) return false;
+
+    const auto origin = r.origin();
+    const auto direction = r.direction();
+    const vec3 inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = root;
+    bool hit_anything = false;
+
+    while(true)
+    {
+        const node& n = m_nodes[current];
+        if(n.box.hit(origin, inv_dir, t_min, t_max))
+        {
+            if(n.count > 0)
+            {
+                if(hit_leaf<any_hit>(n, r, t_min, t_max, rec))
+                {
+                    if(any_hit) return true;
+                    hit_anything = true;
+                }
+            }
+            else
+            {
+                // Visit the child on the near side of the split first so that t_max shrinks sooner
+                if(direction[n.axis] < 0)
+                {
+                    stack[stack_size++] = current + 1;
+                    current = n.first;
+                }
+                else
+                {
+                    stack[stack_size++] = n.first;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// Same scheme as bvh_node::hit_packet: a test against the packet bounds, then rays are tested one by one up to
+// the first that hits the box. A subtree reached by a single ray is finished by single-ray traversal
+void primitive_bvh::hit_packet(ray_packet& packet, uint32_t mask, real t_min) const
+{
+    if(m_nodes.empty()) return;
+
+    struct entry
+    {
+        uint32_t index;
+        uint32_t mask;
+    };
+
+    entry stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = {0, mask};
+
+    while(stack_size > 0)
+    {
+        auto current = stack[--stack_size];
+        const node& n = m_nodes[current.index];
+
+        if(packet.coherent && !n.box.hit(packet.origin_min, packet.origin_max, packet.inv_dir_min, packet.inv_dir_max, t_min, packet.t_far)) continue;
+
+        auto active = current.mask;
+        for(; active; active &= active - 1)
+        {
+            auto i = first_ray(active);
+            if(n.box.hit(packet.rays[i].origin(), packet.inv_dir[i], t_min, packet.t_max[i])) break;
+        }
+        if(active == 0) continue;
+
+        if((active & (active - 1)) == 0 || n.count > 0)
+        {
+            for(; active; active &= active - 1)
+            {
+                auto i = first_ray(active);
+                bool found = n.count > 0 ? hit_leaf<false>(n, packet.rays[i], t_min, packet.t_max[i], packet.recs[i])
+                                         : traverse<false>(packet.rays[i], t_min, packet.t_max[i], packet.recs[i], current.index);
+                if(found)
+                {
+                    packet.t_max[i] = packet.recs[i].t;
+                    packet.hit_mask |= 1u << i;
+                }
+            }
+            continue;
+        }
+
+        // Near child on top of the stack, judged by the first active ray
+        auto near_first = packet.rays[first_ray(active)].direction()[n.axis] >= 0;
+        stack[stack_size++] = {near_first ? n.first : current.index + 1, active};
+        stack[stack_size++] = {near_first ? current.index + 1 : n.first, active};
+    }
+}
+
+#endif
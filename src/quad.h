@@ -0,0 +1,137 @@
+#ifndef _QUAD_h
+#define _QUAD_h
+
+#include "utilities.h"
+#include "hittable.h"
+#include "material.h"
+
+// Parallelogram spanned by the edges {u} and {v} from the corner {Q}, in any orientation
+// The plane and the projections giving the (u, v) coordinates of a point are precomputed, so a hit
+// costs a handful of dot products, about the same as an axis-aligned rect. Texture coordinates run
+// from 0 to 1 along each edge and the outward normal is cross(u, v)
+class quad : public hittable
+{
+public:
+    quad() {}
+    quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> m_ptr) : m_Q(Q), m_u(u), m_v(v), mat(m_ptr)
+    {
+        auto n = cross(u, v);
+        m_normal = unit_vector(n);
+        m_D = dot(m_normal, Q);
+        m_area = n.length();
+
+        // With w = n / |n|^2, a point p = Q + a*u + b*v gives a = dot(p - Q, cross(v, w)) and b = dot(p - Q, cross(w, u))
+        auto w = n / dot(n, n);
+        m_u_axis = cross(v, w);
+        m_v_axis = cross(w, u);
+    }
+
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        real t, a, b;
+        return intersect(r, t_min, t_max, t, a, b);
+    }
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override;
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override { add_light(lights, this, mat.get(), m_area, m_normal, 0); }
+
+    // Uniform sampling over the area, converted to a density over solid angle
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        real t, a, b;
+        if(!intersect(ray(origin, direction), 0.001, infinity, t, a, b)) return 0;
+
+        auto distance_squared = t * t * direction.length_squared();
+        auto cosine = fabs(dot(direction, m_normal)) / direction.length();
+        return distance_squared / (cosine * m_area);
+    }
+
+    virtual vec3 random(const point3& origin) const override
+    {
+        return m_Q + random_double() * m_u + random_double() * m_v - origin;
+    }
+
+private:
+    bool intersect(const ray& r, real t_min, real t_max, real& t, real& a, real& b) const;
+
+    point3 m_Q;
+    vec3 m_u, m_v;
+    vec3 m_normal;
+    real m_D;
+    real m_area;
+    vec3 m_u_axis, m_v_axis;
+    shared_ptr<material> mat;
+};
+
+bool quad::intersect(const ray& r, real t_min, real t_max, real& t, real& a, real& b) const
+{
+    // Rays parallel to the plane get an infinite or NaN distance and fail the range test
+    t = (m_D - dot(m_normal, r.origin())) / dot(m_normal, r.direction());
+    if(!(t >= t_min && t <= t_max) || t == infinity) return false;
+
+    auto planar = r.at(t) - m_Q;
+    a = dot(planar, m_u_axis);
+    b = dot(planar, m_v_axis);
+    return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+}
+
+bool quad::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+    real t, a, b;
+    if(!intersect(r, t_min, t_max, t, a, b)) return false;
+
+    rec.t = t;
+    rec.b1 = a;
+    rec.b2 = b;
+    rec.object = this;
+    return true;
+}
+
+void quad::finalize(const ray& r, hit_record& rec) const
+{
+    rec.p = r.at(rec.t);
+    if(needs_uv(mat.get()))
+    {
+        rec.u = rec.b1;
+        rec.v = rec.b2;
+    }
+    rec.set_face_normal(r, m_normal);
+    rec.mat_ptr = mat.get();
+}
+
+// Box of the four corners, padded so that it never has zero thickness
+bool quad::bounding_box(real time0, real time1, aabb& output_box) const
+{
+    point3 corners[3] = {m_Q + m_u, m_Q + m_v, m_Q + m_u + m_v};
+    point3 min = m_Q;
+    point3 max = m_Q;
+    for(const auto& corner : corners)
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            min[c] = fmin(min[c], corner[c]);
+            max[c] = fmax(max[c], corner[c]);
+        }
+    }
+
+    for(int c = 0; c < 3; c++)
+    {
+        if(max[c] - min[c] < 0.0002)
+        {
+            min[c] -= 0.0001;
+            max[c] += 0.0001;
+        }
+    }
+
+    output_box = aabb(min, max);
+    return true;
+}
+
+#endif
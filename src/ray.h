@@ -1,6 +1,9 @@
 #ifndef _RAY_h
 #define _RAY_h
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include "vec3.h"
 
 // Ray class that starts at an origin and has a direction
@@ -8,18 +11,51 @@ class ray
 {
 public:
     ray()=default;
-    ray(point3 org, vec3 dir, double time=0.0) : m_origin(org), m_direction(dir), tm(time) {}
+    ray(point3 org, vec3 dir, real time=0.0) : m_origin(org), m_direction(dir), tm(time) {}
 
     point3 origin() const { return m_origin; }
     vec3 direction() const { return m_direction; }
-    double time() const { return tm; }
+    real time() const { return tm; }
 
-    vec3 at(const double param) const { return m_origin + param * m_direction; }
+    vec3 at(const real param) const { return m_origin + param * m_direction; }
 
 private:
     point3 m_origin;
     vec3 m_direction;
-    double tm;
+    real tm;
 };
 
+// Origin for a ray leaving the surface point {p} in {direction}, pushed off the surface along the
+// normal on the side the ray leaves from, so that it can't hit the surface it starts on again
+// The push is a fixed number of units in the last place of each coordinate, which scales with the
+// rounding error of the hit point in both float and double builds; coordinates close to zero, where
+// units in the last place get tiny, are moved by a small fixed distance instead
+inline point3 offset_ray_origin(const point3& p, const vec3& normal, const vec3& direction)
+{
+    using bits = std::conditional<sizeof(real) == 4, int32_t, int64_t>::type;
+    const real origin_threshold = static_cast<real>(1.0 / 32);
+    const real fixed_scale = 128 * std::numeric_limits<real>::epsilon();
+    const real ulp_scale = 256;
+
+    const vec3 n = dot(normal, direction) < 0 ? -normal : normal;
+    point3 result;
+    for(int a = 0; a < 3; a++)
+    {
+        real value = p[a];
+        if(fabs(value) < origin_threshold)
+        {
+            result[a] = value + fixed_scale * n[a];
+            continue;
+        }
+
+        bits value_bits;
+        std::memcpy(&value_bits, &value, sizeof(real));
+        auto offset = static_cast<bits>(ulp_scale * n[a]);
+        value_bits += value < 0 ? -offset : offset;
+        std::memcpy(&value, &value_bits, sizeof(real));
+        result[a] = value;
+    }
+    return result;
+}
+
 #endif
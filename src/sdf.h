@@ -0,0 +1,239 @@
+#ifndef _SDF_h
+#define _SDF_h
+
+#include <memory>
+#include "utilities.h"
+#include "aabb.h"
+
+// Signed distance function: negative inside the shape, positive outside
+// distance() may underestimate the true distance (a bound), but must never overestimate it,
+// since sphere tracing steps by it. bounds() encloses the zero set of the function
+class sdf
+{
+public:
+    virtual real distance(const point3& p) const=0;
+    virtual aabb bounds() const=0;
+};
+
+
+// Primitives
+
+class sdf_sphere : public sdf
+{
+public:
+    sdf_sphere(const point3& center, real radius) : m_center(center), m_radius(radius) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        return (p - m_center).length() - m_radius;
+    }
+
+    virtual aabb bounds() const override
+    {
+        return aabb(m_center - vec3(m_radius, m_radius, m_radius), m_center + vec3(m_radius, m_radius, m_radius));
+    }
+
+private:
+    point3 m_center;
+    real m_radius;
+};
+
+// Box with rounded edges of radius {rounding}, which is taken off the half extents
+class sdf_box : public sdf
+{
+public:
+    sdf_box(const point3& center, const vec3& half_extents, real rounding=0) : m_center(center), m_half(half_extents), m_rounding(rounding) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        vec3 q;
+        for(int a = 0; a < 3; a++) q[a] = fabs(p[a] - m_center[a]) - (m_half[a] - m_rounding);
+
+        vec3 outside(fmax(q.x(), 0.0), fmax(q.y(), 0.0), fmax(q.z(), 0.0));
+        auto inside = fmin(fmax(q.x(), fmax(q.y(), q.z())), 0.0);
+        return outside.length() + inside - m_rounding;
+    }
+
+    virtual aabb bounds() const override
+    {
+        return aabb(m_center - m_half, m_center + m_half);
+    }
+
+private:
+    point3 m_center;
+    vec3 m_half;
+    real m_rounding;
+};
+
+// Torus around the y axis through {center}
+class sdf_torus : public sdf
+{
+public:
+    sdf_torus(const point3& center, real major_radius, real minor_radius) : m_center(center), m_major(major_radius), m_minor(minor_radius) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        auto d = p - m_center;
+        auto ring = sqrt(d.x() * d.x() + d.z() * d.z()) - m_major;
+        return sqrt(ring * ring + d.y() * d.y()) - m_minor;
+    }
+
+    virtual aabb bounds() const override
+    {
+        auto r = m_major + m_minor;
+        return aabb(m_center - vec3(r, m_minor, r), m_center + vec3(r, m_minor, r));
+    }
+
+private:
+    point3 m_center;
+    real m_major;
+    real m_minor;
+};
+
+// Mandelbulb fractal of the given {power}, fitted into a sphere of radius about 1.2 * {scale}
+// The distance is the usual escape-time estimate, so more {iterations} give finer detail at a higher cost
+class sdf_mandelbulb : public sdf
+{
+public:
+    sdf_mandelbulb(const point3& center, real scale, real power=8, int iterations=12)
+    : m_center(center), m_scale(scale), m_power(power), m_iterations(iterations) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        auto c = (p - m_center) / m_scale;
+        auto z = c;
+        real dr = 1;
+        real r = z.length();
+
+        for(int i = 0; i < m_iterations && r <= 2; i++)
+        {
+            // z = z^power + c in spherical coordinates
+            auto theta = acos(clamp(z.z() / r, -1.0, 1.0)) * m_power;
+            auto phi = atan2(z.y(), z.x()) * m_power;
+            auto r_pow = pow(r, m_power - 1);
+            dr = r_pow * m_power * dr + 1;
+
+            r_pow *= r;
+            z = r_pow * vec3(sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta)) + c;
+            r = z.length();
+            if(r == 0) break;
+        }
+
+        if(r == 0) return 0;
+        return 0.5 * log(r) * r / dr * m_scale;
+    }
+
+    virtual aabb bounds() const override
+    {
+        auto r = 1.2 * m_scale;
+        return aabb(m_center - vec3(r, r, r), m_center + vec3(r, r, r));
+    }
+
+private:
+    point3 m_center;
+    real m_scale;
+    real m_power;
+    int m_iterations;
+};
+
+
+// Combinations
+
+class sdf_union : public sdf
+{
+public:
+    sdf_union(shared_ptr<sdf> a, shared_ptr<sdf> b) : m_a(a), m_b(b) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        return fmin(m_a->distance(p), m_b->distance(p));
+    }
+
+    virtual aabb bounds() const override
+    {
+        return surrounding_box(m_a->bounds(), m_b->bounds());
+    }
+
+private:
+    shared_ptr<sdf> m_a;
+    shared_ptr<sdf> m_b;
+};
+
+class sdf_intersection : public sdf
+{
+public:
+    sdf_intersection(shared_ptr<sdf> a, shared_ptr<sdf> b) : m_a(a), m_b(b) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        return fmax(m_a->distance(p), m_b->distance(p));
+    }
+
+    virtual aabb bounds() const override
+    {
+        auto a = m_a->bounds();
+        auto b = m_b->bounds();
+        point3 min, max;
+        for(int c = 0; c < 3; c++)
+        {
+            min[c] = fmax(a.min()[c], b.min()[c]);
+            max[c] = fmax(min[c], fmin(a.max()[c], b.max()[c]));
+        }
+        return aabb(min, max);
+    }
+
+private:
+    shared_ptr<sdf> m_a;
+    shared_ptr<sdf> m_b;
+};
+
+// {a} with {b} carved out of it
+class sdf_difference : public sdf
+{
+public:
+    sdf_difference(shared_ptr<sdf> a, shared_ptr<sdf> b) : m_a(a), m_b(b) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        return fmax(m_a->distance(p), -m_b->distance(p));
+    }
+
+    virtual aabb bounds() const override
+    {
+        return m_a->bounds();
+    }
+
+private:
+    shared_ptr<sdf> m_a;
+    shared_ptr<sdf> m_b;
+};
+
+// Union with the seam filleted over a distance of about {k}
+class sdf_smooth_union : public sdf
+{
+public:
+    sdf_smooth_union(shared_ptr<sdf> a, shared_ptr<sdf> b, real k) : m_a(a), m_b(b), m_k(k) {}
+
+    virtual real distance(const point3& p) const override
+    {
+        auto da = m_a->distance(p);
+        auto db = m_b->distance(p);
+        auto h = clamp(0.5 + 0.5 * (db - da) / m_k, 0.0, 1.0);
+        return db + (da - db) * h - m_k * h * (1 - h);
+    }
+
+    // The blend only adds material between the shapes, at most k/4 away from either of them
+    virtual aabb bounds() const override
+    {
+        auto box = surrounding_box(m_a->bounds(), m_b->bounds());
+        auto pad = vec3(m_k, m_k, m_k) * 0.25;
+        return aabb(box.min() - pad, box.max() + pad);
+    }
+
+private:
+    shared_ptr<sdf> m_a;
+    shared_ptr<sdf> m_b;
+    real m_k;
+};
+
+#endif
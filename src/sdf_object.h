@@ -0,0 +1,208 @@
+#ifndef _SDF_OBJECT_h
+#define _SDF_OBJECT_h
+
+#include <vector>
+#include "utilities.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "sdf.h"
+#include "material.h"
+
+// Hittable for a signed distance function, intersected by sphere tracing inside its bounding box
+// A hit is a point closer than {epsilon} to the surface (in world units); rays that take more than
+// {max_steps} steps are treated as misses. With a {cache_resolution} above 0 the distances at the
+// centres of a coarse grid of cells over the bounds are precomputed. Away from the surface a cached
+// value gives a safe step without evaluating the function, which pays off for expensive functions
+// such as fractals; cells the surface passes through always use the exact function
+class sdf_object : public hittable
+{
+public:
+    sdf_object(shared_ptr<sdf> shape, shared_ptr<material> m_ptr, real epsilon=1e-4, int max_steps=256, int cache_resolution=0)
+    : m_shape(shape), mat(m_ptr), m_epsilon(epsilon), m_max_steps(max_steps)
+    {
+        auto box = shape->bounds();
+        auto pad = vec3(2 * epsilon, 2 * epsilon, 2 * epsilon);
+        m_box = aabb(box.min() - pad, box.max() + pad);
+
+        if(cache_resolution > 0) build_cache(cache_resolution);
+    }
+
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    // The normal takes four more evaluations of the function, so it is only computed for the closest hit
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        real t;
+        return march(r, t_min, t_max, t);
+    }
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
+    {
+        output_box = m_box;
+        return true;
+    }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(mat.get()); }
+
+private:
+    bool march(const ray& r, real t_min, real t_max, real& t) const;
+
+    // Distance that can safely be travelled from {p} along {unit_direction}: the unsigned distance
+    // to the surface, or a longer step through a cell of the cache that the surface doesn't reach
+    real distance_bound(const point3& p, const vec3& unit_direction) const;
+
+    vec3 gradient_normal(const point3& p) const;
+
+    void build_cache(int resolution);
+
+    shared_ptr<sdf> m_shape;
+    shared_ptr<material> mat;
+    real m_epsilon;
+    int m_max_steps;
+    aabb m_box;
+
+    // Distance cache: |distance| at the centre of each cell, or a negative value where the cell
+    // may come within epsilon of the surface
+    int m_cache_resolution = 0;
+    vec3 m_cell_size;
+    vec3 m_inv_cell_size;
+    std::vector<float> m_cache;
+};
+
+void sdf_object::build_cache(int resolution)
+{
+    m_cache_resolution = resolution;
+    m_cell_size = (m_box.max() - m_box.min()) / resolution;
+    m_inv_cell_size = vec3(1 / m_cell_size.x(), 1 / m_cell_size.y(), 1 / m_cell_size.z());
+    auto half_diagonal = 0.5 * m_cell_size.length();
+
+    m_cache.resize(static_cast<size_t>(resolution) * resolution * resolution);
+    size_t i = 0;
+    for(int z = 0; z < resolution; z++)
+    {
+        for(int y = 0; y < resolution; y++)
+        {
+            for(int x = 0; x < resolution; x++)
+            {
+                auto center = m_box.min() + vec3((x + 0.5) * m_cell_size.x(), (y + 0.5) * m_cell_size.y(), (z + 0.5) * m_cell_size.z());
+                auto d = fabs(m_shape->distance(center));
+                m_cache[i++] = d > half_diagonal + m_epsilon ? static_cast<float>(d) : -1.0f;
+            }
+        }
+    }
+}
+
+real sdf_object::distance_bound(const point3& p, const vec3& unit_direction) const
+{
+    if(m_cache_resolution > 0)
+    {
+        // Position in cell units
+        auto g = vec3((p.x() - m_box.min().x()) * m_inv_cell_size.x(), (p.y() - m_box.min().y()) * m_inv_cell_size.y(), (p.z() - m_box.min().z()) * m_inv_cell_size.z());
+        int cell[3];
+        bool inside = true;
+        for(int a = 0; a < 3; a++)
+        {
+            cell[a] = static_cast<int>(floor(g[a]));
+            inside = inside && cell[a] >= 0 && cell[a] < m_cache_resolution;
+        }
+
+        if(inside)
+        {
+            auto cached = m_cache[(static_cast<size_t>(cell[2]) * m_cache_resolution + cell[1]) * m_cache_resolution + cell[0]];
+            if(cached > 0)
+            {
+                // Nothing in the cell is within epsilon of the surface, so the ray can go straight to where it
+                // leaves the cell. Further than that, the distance changes at most as fast as the position
+                real exit = infinity;
+                vec3 to_center;
+                for(int a = 0; a < 3; a++)
+                {
+                    auto to_face = (unit_direction[a] > 0 ? cell[a] + 1 - g[a] : cell[a] - g[a]) * m_cell_size[a];
+                    if(unit_direction[a] != 0) exit = fmin(exit, to_face / unit_direction[a]);
+                    to_center[a] = (cell[a] + 0.5 - g[a]) * m_cell_size[a];
+                }
+
+                return fmax(exit + m_epsilon, cached - to_center.length());
+            }
+        }
+    }
+
+    return fabs(m_shape->distance(p));
+}
+
+bool sdf_object::march(const ray& r, real t_min, real t_max, real& t) const
+{
+    // Clip the ray to the bounds first, so marching starts and ends at the box
+    real t_enter = t_min;
+    real t_exit = t_max;
+    for(int a = 0; a < 3; a++)
+    {
+        auto invD = 1.0 / r.direction()[a];
+        auto t0 = (m_box.min()[a] - r.origin()[a]) * invD;
+        auto t1 = (m_box.max()[a] - r.origin()[a]) * invD;
+        if(invD < 0.0) std::swap(t0, t1);
+        t_enter = fmax(t0, t_enter);
+        t_exit = fmin(t1, t_exit);
+    }
+    if(t_exit < t_enter) return false;
+
+    // Steps are in world units and the direction isn't normalized
+    auto inv_length = 1.0 / r.direction().length();
+    auto unit_direction = r.direction() * inv_length;
+
+    // Rays leaving the surface (reflected and refracted rays) start within epsilon of it; those only
+    // count as hits once they have been clear of the surface
+    bool clear = false;
+    t = t_enter;
+    for(int step = 0; step < m_max_steps && t <= t_exit; step++)
+    {
+        auto d = distance_bound(r.at(t), unit_direction);
+        if(d < m_epsilon)
+        {
+            if(clear) return true;
+            d = m_epsilon;
+        }
+        else
+        {
+            clear = true;
+        }
+
+        t += d * inv_length;
+    }
+
+    return false;
+}
+
+// Central differences over a tetrahedron, 4 evaluations instead of 6
+vec3 sdf_object::gradient_normal(const point3& p) const
+{
+    const auto h = m_epsilon;
+    const vec3 k0(1, -1, -1), k1(-1, -1, 1), k2(-1, 1, -1), k3(1, 1, 1);
+
+    auto n = k0 * m_shape->distance(p + h * k0) + k1 * m_shape->distance(p + h * k1)
+           + k2 * m_shape->distance(p + h * k2) + k3 * m_shape->distance(p + h * k3);
+    return unit_vector(n);
+}
+
+bool sdf_object::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+    real t;
+    if(!march(r, t_min, t_max, t)) return false;
+
+    rec.t = t;
+    rec.object = this;
+    return true;
+}
+
+void sdf_object::finalize(const ray& r, hit_record& rec) const
+{
+    rec.p = r.at(rec.t);
+    auto outward_normal = gradient_normal(rec.p);
+    rec.set_face_normal(r, outward_normal);
+    if(needs_uv(mat.get())) sphere::get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = mat.get();
+}
+
+#endif
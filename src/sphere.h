@@ -2,15 +2,17 @@
 #define _SPHERE_h
 
 #include "hittable.h"
+#include "material.h"
+#include "onb.h"
 #include "utilities.h"
 
 // Class for sphere primitives that can be intersected by a ray and rendered
 class sphere : public hittable
 {
 public:
-    sphere(point3 c, double r, std::shared_ptr<material> mat) : m_center(c), m_radius(r), m_mat(mat) {}
+    sphere(point3 c, real r, std::shared_ptr<material> mat) : m_center(c), m_radius(r), m_mat(mat) {}
 
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override 
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override 
     {
         auto ray_org_to_center = r.origin() - m_center;
         auto a = r.direction().length_squared();
@@ -32,22 +34,79 @@ public:
         }
 
         rec.t = root;
+        rec.object = this;
+        return true;
+    }
+
+    virtual void finalize(const ray& r, hit_record& rec) const override
+    {
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - m_center) / m_radius;
         rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat_ptr = m_mat;
-        return true;
+        if(needs_uv(m_mat.get())) get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat_ptr = m_mat.get();
+    }
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        auto ray_org_to_center = r.origin() - m_center;
+        auto a = r.direction().length_squared();
+        auto half_b = dot(r.direction(), ray_org_to_center);
+        auto c = ray_org_to_center.length_squared() - m_radius * m_radius;
+
+        auto discriminant = half_b * half_b - a * c;
+        if(discriminant < 0) return false;
+
+        auto sqrt_disc = std::sqrt(discriminant);
+        auto root = (-half_b - sqrt_disc) / a;
+        if(root >= t_min && root <= t_max) return true;
+
+        root = (-half_b + sqrt_disc) / a;
+        return root >= t_min && root <= t_max;
     }
 
-    virtual bool bounding_box(double time0, double time1, aabb& output_box) const override
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
     {
         output_box = aabb(m_center - vec3(m_radius), m_center + vec3(m_radius));
         return true;
     }
 
-private:
-    static void get_sphere_uv(const point3& p, double& u, double& v)
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(m_mat.get()); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override { add_light(lights, this, m_mat.get(), 4 * pi * m_radius * m_radius, vec3(0, 0, 1), pi); }
+
+    // Directions are sampled uniformly in the cone of directions from {origin} that hit the sphere,
+    // so the density is one over the cone's solid angle. Points inside the sphere can't sample it
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        auto distance_squared = (m_center - origin).length_squared();
+        if(distance_squared <= m_radius * m_radius || !occluded(ray(origin, direction), 0.001, infinity)) return 0;
+
+        auto cos_theta_max = sqrt(1 - m_radius * m_radius / distance_squared);
+        return 1 / (2 * pi * (1 - cos_theta_max));
+    }
+
+    virtual vec3 random(const point3& origin) const override
+    {
+        vec3 to_center = m_center - origin;
+        auto distance_squared = to_center.length_squared();
+        if(distance_squared <= m_radius * m_radius) return to_center;
+
+        auto cos_theta_max = sqrt(1 - m_radius * m_radius / distance_squared);
+        auto z = 1 + random_double() * (cos_theta_max - 1);
+        auto phi = 2 * pi * random_double();
+        auto sin_theta = sqrt(1 - z * z);
+        auto direction = onb(to_center).local(cos(phi) * sin_theta, sin(phi) * sin_theta, z);
+
+        // Distance to the near side of the sphere along the direction, which is within the cone
+        auto half_b = dot(direction, -to_center);
+        auto c = distance_squared - m_radius * m_radius;
+        auto t = -half_b - sqrt(fmax(half_b * half_b - c, 0.0));
+        return t * direction;
+    }
+
+    // Texture coordinates of a point {p} on the unit sphere
+    static void get_sphere_uv(const point3& p, real& u, real& v)
     {
         auto theta = acos(-p.y());
         auto phi = atan2(-p.z(), p.x()) + pi;
@@ -56,9 +115,10 @@ private:
         v = theta / pi;
     }
 
+private:
 
     point3 m_center;
-    double m_radius;
+    real m_radius;
     std::shared_ptr<material> m_mat;
 };
 
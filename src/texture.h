@@ -9,7 +9,10 @@
 class texture
 {
 public:
-    virtual color value(double u, double v, const point3& p) const = 0;
+    virtual color value(real u, real v, const point3& p) const = 0;
+
+    // Whether value() reads the texture coordinates {u} and {v}, rather than only the point
+    virtual bool uses_uv() const { return true; }
 };
 
 
@@ -20,13 +23,17 @@ public:
     solid_color() {}
     solid_color(color c) : m_color_value(c) {}
 
-    solid_color(double red, double green, double blue) : m_color_value(color(red, green, blue)) {}
+    solid_color(real red, real green, real blue) : m_color_value(color(red, green, blue)) {}
 
-    virtual color value(double u, double v, const point3& p) const override
+    virtual color value(real u, real v, const point3& p) const override
     {
         return m_color_value;
     }
 
+    virtual bool uses_uv() const override { return false; }
+
+    const color& color_value() const { return m_color_value; }
+
 private:
     color m_color_value;
 };
@@ -41,7 +48,7 @@ public:
 
     checker_texture(color c1, color c2) : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)) {}
 
-    virtual color value(double u, double v, const point3& p) const override
+    virtual color value(real u, real v, const point3& p) const override
     {
         auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
         if(sines < 0) 
@@ -54,6 +61,8 @@ public:
         }
     } 
 
+    virtual bool uses_uv() const override { return odd->uses_uv() || even->uses_uv(); }
+
 private:
     shared_ptr<texture> odd;
     shared_ptr<texture> even;
@@ -64,16 +73,18 @@ class noise_texture : public texture
 {
 public:
     noise_texture() {}
-    noise_texture(double sc) : scale(sc) {}
+    noise_texture(real sc) : scale(sc) {}
 
-    virtual color value(double u, double v, const point3& p) const override
+    virtual color value(real u, real v, const point3& p) const override
     {
         return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p)));
     }
 
+    virtual bool uses_uv() const override { return false; }
+
 private:
     perlin noise;
-    double scale;
+    real scale;
 };
 
 
@@ -105,7 +116,7 @@ public:
         delete m_img;
     }
 
-    virtual color value(double u, double v, const point3& p) const override
+    virtual color value(real u, real v, const point3& p) const override
     {
         if(m_img == nullptr)
         {   
@@ -0,0 +1,190 @@
+#ifndef _TRANSFORM_h
+#define _TRANSFORM_h
+
+#include <memory>
+#include "utilities.h"
+#include "hittable.h"
+#include "matrix.h"
+
+// Instance of a hittable placed in the scene by an arbitrary affine transformation
+// Rays are carried into object space with the precomputed inverse matrix, so the cost per ray is
+// the same whatever the transformation is. Wrapping a transform in another transform doesn't nest:
+// the matrices are composed at construction and the new instance wraps the original object directly
+class transform : public hittable
+{
+public:
+    transform(shared_ptr<hittable> object, const matrix34& object_to_world) : ptr(object), m_to_world(object_to_world)
+    {
+        if(auto inner = std::dynamic_pointer_cast<transform>(object))
+        {
+            ptr = inner->ptr;
+            m_to_world = object_to_world * inner->m_to_world;
+        }
+
+        m_to_object = m_to_world.inverse();
+    }
+
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override
+    {
+        return ptr->occluded(to_object(r), t_min, t_max);
+    }
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override;
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { ptr->collect_materials(materials); }
+
+    virtual void collect_lights(std::vector<scene_light>& lights) const override;
+
+    virtual real pdf_value(const point3& origin, const vec3& direction) const override;
+
+    virtual vec3 random(const point3& origin) const override
+    {
+        return m_to_world.transform_vector(ptr->random(m_to_object.transform_point(origin)));
+    }
+
+    // hit() already completed the record
+    virtual void finalize(const ray& r, hit_record& rec) const override {}
+
+    virtual bool moves() const override { return ptr->moves(); }
+
+    const matrix34& object_to_world() const { return m_to_world; }
+
+private:
+    // The direction isn't normalized, so distances along the ray are the same in both spaces
+    ray to_object(const ray& r) const
+    {
+        return ray(m_to_object.transform_point(r.origin()), m_to_object.transform_vector(r.direction()), r.time());
+    }
+
+    shared_ptr<hittable> ptr;
+    matrix34 m_to_world;
+    matrix34 m_to_object;
+};
+
+bool transform::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+    auto local = to_object(r);
+    if(!ptr->hit(local, t_min, t_max, rec)) return false;
+
+    // The object's record is only complete in object space, so it is finished before being carried to world space
+    finalize_hit(local, rec);
+
+    // The normal already faces against the object space ray and keeps doing so in world space,
+    // so front_face is left as the object computed it
+    rec.p = m_to_world.transform_point(rec.p);
+    rec.normal = unit_vector(m_to_object.transform_normal_transposed(rec.normal));
+
+    // Reported as the object that was hit, so that hits on an instanced light match its entry in light_list
+    rec.object = this;
+    return true;
+}
+
+// An instance is a light when the object it wraps is one, and is then sampled in place of it
+// Lights inside aggregates the instance wraps can't be sampled through it and are left out
+void transform::collect_lights(std::vector<scene_light>& lights) const
+{
+    std::vector<scene_light> inner;
+    ptr->collect_lights(inner);
+    if(inner.size() != 1 || inner[0].object != ptr.get()) return;
+
+    // A flat light's area scales with the volume, divided by the scaling along its normal. Other lights are given
+    // the area a uniform scaling by the same volume would, which only changes how often light_list picks them
+    auto light = inner[0];
+    auto volume_scale = std::fabs(1 / m_to_object.determinant());
+    if(light.normal_angle == 0)
+    {
+        light.area *= volume_scale * m_to_object.transform_normal_transposed(unit_vector(light.axis)).length();
+    }
+    else
+    {
+        light.area *= std::pow(volume_scale, real(2) / 3);
+    }
+    light.axis = m_to_object.transform_normal_transposed(light.axis);
+    light.object = this;
+    lights.push_back(light);
+}
+
+// The object's density is per unit of solid angle in object space. Carrying direction w to object space
+// as A w / |A w|, with A the linear part of m_to_object, changes solid angles by |det A| / |A w|^3 for unit w,
+// which is 1 for rotations, translations and uniform scalings
+real transform::pdf_value(const point3& origin, const vec3& direction) const
+{
+    auto local_direction = m_to_object.transform_vector(direction);
+    auto pdf = ptr->pdf_value(m_to_object.transform_point(origin), local_direction);
+    if(pdf <= 0) return 0;
+
+    real ratio = direction.length() / local_direction.length();
+    return pdf * std::fabs(m_to_object.determinant()) * ratio * ratio * ratio;
+}
+
+// Bounds of the 8 transformed corners of the object's box
+bool transform::bounding_box(real time0, real time1, aabb& output_box) const
+{
+    aabb bbox;
+    if(!ptr->bounding_box(time0, time1, bbox)) return false;
+
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
+
+    for(int i = 0; i < 2; i++)
+    {
+        for(int j = 0; j < 2; j++)
+        {
+            for(int k = 0; k < 2; k++)
+            {
+                auto x = i*bbox.max().x() + (1-i)*bbox.min().x();
+                auto y = j*bbox.max().y() + (1-j)*bbox.min().y();
+                auto z = k*bbox.max().z() + (1-k)*bbox.min().z();
+
+                auto tester = m_to_world.transform_point(point3(x, y, z));
+
+                for(int c = 0; c < 3; c++)
+                {
+                    min[c] = fmin(min[c], tester[c]);
+                    max[c] = fmax(max[c], tester[c]);
+                }
+            }
+        }
+    }
+
+    output_box = aabb(min, max);
+    return true;
+}
+
+
+// Shorthands for single transformations; nesting them collapses into one transform
+
+class translate : public transform
+{
+public:
+    translate(shared_ptr<hittable> p, const vec3& displacement) : transform(p, matrix34::translation(displacement)) {}
+};
+
+class rotate_x : public transform
+{
+public:
+    rotate_x(shared_ptr<hittable> p, real angle) : transform(p, matrix34::rotation_x(angle)) {}
+};
+
+class rotate_y : public transform
+{
+public:
+    rotate_y(shared_ptr<hittable> p, real angle) : transform(p, matrix34::rotation_y(angle)) {}
+};
+
+class rotate_z : public transform
+{
+public:
+    rotate_z(shared_ptr<hittable> p, real angle) : transform(p, matrix34::rotation_z(angle)) {}
+};
+
+class scale : public transform
+{
+public:
+    scale(shared_ptr<hittable> p, const vec3& factors) : transform(p, matrix34::scaling(factors)) {}
+    scale(shared_ptr<hittable> p, real factor) : transform(p, matrix34::scaling(vec3(factor))) {}
+};
+
+#endif
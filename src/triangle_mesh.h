@@ -0,0 +1,738 @@
+#ifndef _TRIANGLE_MESH_h
+#define _TRIANGLE_MESH_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "utilities.h"
+#include "hittable.h"
+#include "triangle_packet.h"
+#include "material.h"
+
+// Read-only view of one attribute component or index list, with an arbitrary stride in bytes
+// Views let mesh buffers live either in the mesh's own vectors or in memory owned by something else
+// (e.g. a memory-mapped file), where values may be interleaved with other data and unaligned
+template<typename T>
+struct buffer_view
+{
+    const unsigned char* data = nullptr;
+    size_t stride = sizeof(T);
+    size_t count = 0;
+
+    buffer_view() {}
+    buffer_view(const std::vector<T>& values) : data(reinterpret_cast<const unsigned char*>(values.data())), count(values.size()) {}
+    buffer_view(const void* first, size_t byte_stride, size_t n) : data(static_cast<const unsigned char*>(first)), stride(byte_stride), count(n) {}
+
+    T operator[](size_t i) const
+    {
+        T value;
+        std::memcpy(&value, data + i * stride, sizeof(T));
+        return value;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+// Read-only view of per-triangle index triplets; the three indices of a triangle are contiguous
+// 32-bit values, and consecutive triangles are {stride} bytes apart
+struct triangle_index_view
+{
+    const unsigned char* data = nullptr;
+    size_t stride = 3 * sizeof(uint32_t);
+    size_t count = 0;
+
+    triangle_index_view() {}
+    triangle_index_view(const std::vector<uint32_t>& values) : data(reinterpret_cast<const unsigned char*>(values.data())), count(values.size() / 3) {}
+    triangle_index_view(const void* first, size_t byte_stride, size_t n) : data(static_cast<const unsigned char*>(first)), stride(byte_stride), count(n) {}
+
+    uint32_t operator()(size_t tri, int corner) const
+    {
+        uint32_t value;
+        std::memcpy(&value, data + tri * stride + corner * sizeof(uint32_t), sizeof(uint32_t));
+        return value;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+
+// Vertex and index buffers of an indexed triangle mesh, shared between all meshes built from them
+// Attributes are read as structure-of-arrays with one view per component. Every triangle
+// indexes its positions with a triplet of {indices}; normals and texture coordinates are
+// optional and have their own index lists (as in OBJ files), which stay empty when absent
+struct mesh_data
+{
+    buffer_view<float> px, py, pz;
+    buffer_view<float> nx, ny, nz;
+    buffer_view<float> tu, tv;
+
+    triangle_index_view indices;
+    triangle_index_view normal_indices;
+    triangle_index_view uv_indices;
+
+    // Storage for meshes that own their buffers; fill it, then call bind_owned_buffers()
+    struct buffers
+    {
+        std::vector<float> px, py, pz;
+        std::vector<float> nx, ny, nz;
+        std::vector<float> tu, tv;
+        std::vector<uint32_t> indices, normal_indices, uv_indices;
+    } owned;
+
+    // Keeps memory the views point into alive when it isn't owned by the mesh (e.g. a mapped file)
+    shared_ptr<void> external;
+
+    // Points every view at the matching owned vector
+    void bind_owned_buffers()
+    {
+        px = owned.px; py = owned.py; pz = owned.pz;
+        nx = owned.nx; ny = owned.ny; nz = owned.nz;
+        tu = owned.tu; tv = owned.tv;
+        indices = owned.indices;
+        normal_indices = owned.normal_indices;
+        uv_indices = owned.uv_indices;
+    }
+
+    size_t vertex_count() const { return px.size(); }
+    size_t triangle_count() const { return indices.size(); }
+
+    bool has_normals() const { return !normal_indices.empty(); }
+    bool has_uvs() const { return !uv_indices.empty(); }
+
+    point3 position(uint32_t i) const { return point3(px[i], py[i], pz[i]); }
+    vec3 normal(uint32_t i) const { return vec3(nx[i], ny[i], nz[i]); }
+};
+
+
+// How a triangle_mesh stores what its traversal reads
+//  indexed:    BVH nodes with full boxes, triangles read through the mesh's index and vertex buffers
+//  packets:    the triangles of every leaf are copied into triangle_packets and intersected with SIMD
+//  compressed: like packets, but node boxes are stored as 8-bit offsets within their parent's box
+//              and vertex positions as 16-bit offsets within their leaf's box, decoded while intersecting.
+//              Vertex normals are octahedral-encoded into 32 bits. For meshes too large for the caches
+enum class mesh_layout
+{
+    indexed,
+    packets,
+    compressed
+};
+
+// Hittable for a whole triangle mesh
+// Rather than one hittable per triangle, the mesh keeps its own flattened BVH over triangle indices
+// and plugs into the scene's bvh_node as a single object with the bounding box of all its triangles
+class triangle_mesh : public hittable
+{
+public:
+    triangle_mesh(shared_ptr<mesh_data> data, shared_ptr<material> m, mesh_layout layout = mesh_layout::packets);
+
+    // Hits record the triangle and the barycentrics of the point, normals and texture coordinates are
+    // only interpolated for the closest one
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const override;
+
+    virtual void finalize(const ray& r, hit_record& rec) const override;
+
+    virtual bool occluded(const ray& r, real t_min, real t_max) const override;
+
+    virtual bool bounding_box(real time0, real time1, aabb& output_box) const override
+    {
+        if(m_layout == mesh_layout::compressed)
+        {
+            if(m_compressed_nodes.empty()) return false;
+            output_box = m_root_box;
+            return true;
+        }
+
+        if(m_nodes.empty()) return false;
+
+        output_box = m_nodes[0].box;
+        return true;
+    }
+
+    virtual void collect_materials(std::vector<const material*>& materials) const override { materials.push_back(m_mat.get()); }
+
+    size_t triangle_count() const { return m_data->triangle_count(); }
+
+    // Bytes of the structures the layout reads while intersecting and shading: nodes, leaf triangles,
+    // and the vertex data it uses in place of the mesh's buffers
+    size_t footprint_bytes() const;
+
+private:
+    // Interior nodes store their left child right after themselves and the right child at {first}
+    // Leaves store {count} triangles starting at m_triangles[first], packed into the
+    // triangle_packets starting at m_packets[packets] when packets are enabled
+    struct node
+    {
+        aabb box;
+        uint32_t first;
+        uint32_t count;
+        uint32_t packets;
+        int axis;
+    };
+
+    // Node of the compressed layout; {bounds} are the boxes of the two children, as multiples of 1/255
+    // of this node's box per axis (min x y z, then max x y z). The root's box is kept in full
+    struct compressed_node
+    {
+        uint8_t bounds[2][6];
+        uint32_t first;
+        uint32_t count;
+        uint32_t packets;
+        uint8_t axis;
+    };
+
+    static const int max_leaf_triangles = triangle_packet::width;
+
+    void build_packets();
+
+    void build_compressed(uint32_t index, const aabb& box);
+
+    static void quantize_child_box(const aabb& parent, const aabb& child, uint8_t bounds[6]);
+
+    static aabb decode_child_box(const aabb& parent, const uint8_t bounds[6]);
+
+    uint32_t build(const std::vector<aabb>& boxes, const std::vector<point3>& centroids, size_t start, size_t end);
+
+    bool intersect_triangle(uint32_t tri, const ray& r, real t_min, real t_max, real& t, real& b1, real& b2) const;
+
+    template<bool any_hit>
+    bool traverse(const ray& r, real t_min, real t_max, uint32_t& hit_tri, real& hit_t, real& b1, real& b2) const;
+
+    template<bool any_hit>
+    bool traverse_compressed(const ray& r, real t_min, real t_max, uint32_t& hit_tri, real& hit_t, real& b1, real& b2) const;
+
+    shared_ptr<mesh_data> m_data;
+    shared_ptr<material> m_mat;
+    std::vector<node> m_nodes;
+    std::vector<uint32_t> m_triangles;
+    std::vector<triangle_packet> m_packets;
+    mesh_layout m_layout;
+
+    std::vector<compressed_node> m_compressed_nodes;
+    std::vector<quantized_triangle_packet> m_quantized_packets;
+    std::vector<uint32_t> m_octahedral_normals;
+    aabb m_root_box;
+};
+
+
+// Octahedral encoding of unit vectors into two 16-bit fixed-point coordinates packed in 32 bits
+inline uint32_t encode_octahedral(const vec3& n)
+{
+    auto scale = 1.0 / (fabs(n.x()) + fabs(n.y()) + fabs(n.z()));
+    auto x = n.x() * scale;
+    auto y = n.y() * scale;
+    if(n.z() < 0)
+    {
+        auto folded_x = (1 - fabs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - fabs(x)) * (y >= 0 ? 1 : -1);
+        x = folded_x;
+    }
+
+    auto qx = static_cast<uint32_t>(std::lround((clamp(x, -1, 1) * 0.5 + 0.5) * 65535));
+    auto qy = static_cast<uint32_t>(std::lround((clamp(y, -1, 1) * 0.5 + 0.5) * 65535));
+    return qx | (qy << 16);
+}
+
+inline vec3 decode_octahedral(uint32_t packed)
+{
+    auto x = (packed & 0xffff) / 65535.0 * 2 - 1;
+    auto y = (packed >> 16) / 65535.0 * 2 - 1;
+    auto z = 1 - fabs(x) - fabs(y);
+    if(z < 0)
+    {
+        auto folded_x = (1 - fabs(y)) * (x >= 0 ? 1 : -1);
+        y = (1 - fabs(x)) * (y >= 0 ? 1 : -1);
+        x = folded_x;
+    }
+    return unit_vector(vec3(x, y, z));
+}
+
+
+triangle_mesh::triangle_mesh(shared_ptr<mesh_data> data, shared_ptr<material> m, mesh_layout layout)
+: m_data(data), m_mat(m), m_layout(layout)
+{
+    const size_t tri_count = m_data->triangle_count();
+    if(tri_count == 0) return;
+
+    std::vector<aabb> boxes(tri_count);
+    std::vector<point3> centroids(tri_count);
+    m_triangles.reserve(tri_count);
+
+    // mesh_data can be filled by anything, so triangles with an index past the end of its buffers are left out
+    auto in_range = [](const triangle_index_view& view, size_t tri, size_t count)
+    {
+        return view(tri, 0) < count && view(tri, 1) < count && view(tri, 2) < count;
+    };
+    size_t skipped = 0;
+
+    for(size_t i = 0; i < tri_count; i++)
+    {
+        if(!in_range(m_data->indices, i, m_data->vertex_count()) ||
+           (m_data->has_normals() && !in_range(m_data->normal_indices, i, m_data->nx.size())) ||
+           (m_data->has_uvs() && !in_range(m_data->uv_indices, i, m_data->tu.size())))
+        {
+            skipped++;
+            continue;
+        }
+
+        auto p0 = m_data->position(m_data->indices(i, 0));
+        auto p1 = m_data->position(m_data->indices(i, 1));
+        auto p2 = m_data->position(m_data->indices(i, 2));
+
+        boxes[i] = aabb(point3(fmin(p0.x(), fmin(p1.x(), p2.x())),
+                               fmin(p0.y(), fmin(p1.y(), p2.y())),
+                               fmin(p0.z(), fmin(p1.z(), p2.z()))),
+                        point3(fmax(p0.x(), fmax(p1.x(), p2.x())),
+                               fmax(p0.y(), fmax(p1.y(), p2.y())),
+                               fmax(p0.z(), fmax(p1.z(), p2.z()))));
+        centroids[i] = (p0 + p1 + p2) / 3;
+        m_triangles.push_back(static_cast<uint32_t>(i));
+    }
+
+    if(skipped > 0) std::cerr << "WARNING: triangle_mesh left out " << skipped << " triangles with indices out of range.\n";
+    if(m_triangles.empty()) return;
+
+    m_nodes.reserve(2 * m_triangles.size() / max_leaf_triangles + 1);
+    build(boxes, centroids, 0, m_triangles.size());
+
+    if(m_layout == mesh_layout::packets) build_packets();
+
+    if(m_layout == mesh_layout::compressed)
+    {
+        m_root_box = m_nodes[0].box;
+        m_compressed_nodes.resize(m_nodes.size());
+        build_compressed(0, m_root_box);
+
+        const auto normal_count = m_data->has_normals() ? m_data->nx.size() : 0;
+        m_octahedral_normals.resize(normal_count);
+        for(size_t i = 0; i < normal_count; i++)
+        {
+            auto n = m_data->normal(static_cast<uint32_t>(i));
+            m_octahedral_normals[i] = n.length_squared() > 0 ? encode_octahedral(unit_vector(n)) : encode_octahedral(vec3(0, 0, 1));
+        }
+
+        // The full nodes are only needed while building
+        std::vector<node>().swap(m_nodes);
+    }
+}
+
+// Same median split as bvh_node, but along the longest axis of the triangle centroids
+// and partitioning with nth_element instead of a full sort
+uint32_t triangle_mesh::build(const std::vector<aabb>& boxes, const std::vector<point3>& centroids, size_t start, size_t end)
+{
+    const auto node_index = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(node());
+
+    aabb bounds = boxes[m_triangles[start]];
+    point3 cmin = centroids[m_triangles[start]];
+    point3 cmax = cmin;
+    for(size_t i = start + 1; i < end; i++)
+    {
+        bounds = surrounding_box(bounds, boxes[m_triangles[i]]);
+        for(int a = 0; a < 3; a++)
+        {
+            cmin[a] = fmin(cmin[a], centroids[m_triangles[i]][a]);
+            cmax[a] = fmax(cmax[a], centroids[m_triangles[i]][a]);
+        }
+    }
+    m_nodes[node_index].box = bounds;
+
+    auto extent = cmax - cmin;
+    int axis = 0;
+    if(extent.y() > extent[axis]) axis = 1;
+    if(extent.z() > extent[axis]) axis = 2;
+
+    // Triangles with coincident centroids can't be split any further, so they share a leaf
+    if(end - start <= max_leaf_triangles || extent[axis] <= 0)
+    {
+        m_nodes[node_index].first = static_cast<uint32_t>(start);
+        m_nodes[node_index].count = static_cast<uint32_t>(end - start);
+        return node_index;
+    }
+
+    auto mid = start + (end - start) / 2;
+    std::nth_element(m_triangles.begin() + start, m_triangles.begin() + mid, m_triangles.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    build(boxes, centroids, start, mid);
+    auto right = build(boxes, centroids, mid, end);
+
+    m_nodes[node_index].first = right;
+    m_nodes[node_index].count = 0;
+    m_nodes[node_index].axis = axis;
+    return node_index;
+}
+
+// Packs the triangles of every leaf into consecutive packets; a leaf only has more than
+// one packet when it holds triangles with coincident centroids
+void triangle_mesh::build_packets()
+{
+    for(auto& n : m_nodes)
+    {
+        if(n.count == 0) continue;
+
+        n.packets = static_cast<uint32_t>(m_packets.size());
+        for(uint32_t i = 0; i < n.count; i++)
+        {
+            if(i % triangle_packet::width == 0) m_packets.emplace_back();
+
+            auto tri = m_triangles[n.first + i];
+            m_packets.back().set(i % triangle_packet::width, tri,
+                                 m_data->position(m_data->indices(tri, 0)),
+                                 m_data->position(m_data->indices(tri, 1)),
+                                 m_data->position(m_data->indices(tri, 2)));
+        }
+    }
+}
+
+// Children are quantized against their parent's decoded box rather than its exact one, so that
+// the decoded boxes nest exactly the same way during traversal
+void triangle_mesh::build_compressed(uint32_t index, const aabb& box)
+{
+    const node& n = m_nodes[index];
+    compressed_node& cn = m_compressed_nodes[index];
+    cn.first = n.first;
+    cn.count = n.count;
+    cn.axis = static_cast<uint8_t>(n.count > 0 ? 0 : n.axis);
+    cn.packets = 0;
+
+    if(n.count > 0)
+    {
+        // Leaf: triangles quantized within the leaf's box
+        const quantized_frame frame(box.min(), box.max());
+        cn.packets = static_cast<uint32_t>(m_quantized_packets.size());
+        for(uint32_t i = 0; i < n.count; i++)
+        {
+            if(i % quantized_triangle_packet::width == 0) m_quantized_packets.emplace_back();
+
+            auto tri = m_triangles[n.first + i];
+            uint16_t q[3][3];
+            for(int k = 0; k < 3; k++)
+            {
+                auto p = m_data->position(m_data->indices(tri, k));
+                for(int a = 0; a < 3; a++) q[k][a] = frame.encode(p[a], a);
+            }
+            m_quantized_packets.back().set(i % quantized_triangle_packet::width, q[0], q[1], q[2]);
+        }
+        return;
+    }
+
+    const uint32_t children[2] = {index + 1, n.first};
+    for(int c = 0; c < 2; c++)
+    {
+        quantize_child_box(box, m_nodes[children[c]].box, cn.bounds[c]);
+        build_compressed(children[c], decode_child_box(box, cn.bounds[c]));
+    }
+}
+
+// Rounds the child's box outwards to the 8-bit grid over the parent's box
+void triangle_mesh::quantize_child_box(const aabb& parent, const aabb& child, uint8_t bounds[6])
+{
+    for(int a = 0; a < 3; a++)
+    {
+        auto extent = parent.max()[a] - parent.min()[a];
+        if(extent <= 0)
+        {
+            bounds[a] = 0;
+            bounds[a + 3] = 255;
+            continue;
+        }
+
+        auto lo = static_cast<int>(clamp(floor((child.min()[a] - parent.min()[a]) / extent * 255), 0, 255));
+        auto hi = static_cast<int>(clamp(ceil((child.max()[a] - parent.min()[a]) / extent * 255), 0, 255));
+
+        // Guard against rounding in the decode putting a bound inside the child
+        while(lo > 0 && parent.min()[a] + lo * extent / 255 > child.min()[a]) lo--;
+        while(hi < 255 && parent.min()[a] + hi * extent / 255 < child.max()[a]) hi++;
+
+        bounds[a] = static_cast<uint8_t>(lo);
+        bounds[a + 3] = static_cast<uint8_t>(hi);
+    }
+}
+
+aabb triangle_mesh::decode_child_box(const aabb& parent, const uint8_t bounds[6])
+{
+    point3 min, max;
+    for(int a = 0; a < 3; a++)
+    {
+        auto extent = parent.max()[a] - parent.min()[a];
+        min[a] = parent.min()[a] + bounds[a] * extent / 255;
+        max[a] = bounds[a + 3] == 255 ? parent.max()[a] : parent.min()[a] + bounds[a + 3] * extent / 255;
+    }
+    return aabb(min, max);
+}
+
+// finalize() computes the geometric normal from the mesh's positions in every layout, so the layouts with
+// their own copy of the triangles still keep the position and index buffers resident and read them on closest hits
+size_t triangle_mesh::footprint_bytes() const
+{
+    size_t position_bytes = m_data->vertex_count() * 3 * sizeof(float) + triangle_count() * 3 * sizeof(uint32_t);
+    switch(m_layout)
+    {
+    case mesh_layout::indexed:
+    {
+        // Positions and normals read through the index buffers
+        size_t normal_bytes = m_data->has_normals() ? m_data->nx.size() * 3 * sizeof(float) + triangle_count() * 3 * sizeof(uint32_t) : 0;
+        return m_nodes.size() * sizeof(node) + m_triangles.size() * sizeof(uint32_t) + position_bytes + normal_bytes;
+    }
+    case mesh_layout::packets:
+    {
+        size_t normal_bytes = m_data->has_normals() ? m_data->nx.size() * 3 * sizeof(float) + triangle_count() * 3 * sizeof(uint32_t) : 0;
+        return m_nodes.size() * sizeof(node) + m_packets.size() * sizeof(triangle_packet) + position_bytes + normal_bytes;
+    }
+    default:
+    {
+        size_t normal_bytes = m_octahedral_normals.size() * sizeof(uint32_t) + (m_data->has_normals() ? triangle_count() * 3 * sizeof(uint32_t) : 0);
+        return m_compressed_nodes.size() * sizeof(compressed_node) + m_quantized_packets.size() * sizeof(quantized_triangle_packet)
+             + m_triangles.size() * sizeof(uint32_t) + position_bytes + normal_bytes;
+    }
+    }
+}
+
+bool triangle_mesh::intersect_triangle(uint32_t tri, const ray& r, real t_min, real t_max, real& t, real& b1, real& b2) const
+{
+    auto v0 = m_data->position(m_data->indices(tri, 0));
+    auto edge1 = m_data->position(m_data->indices(tri, 1)) - v0;
+    auto edge2 = m_data->position(m_data->indices(tri, 2)) - v0;
+
+    return ::intersect_triangle(r.origin(), r.direction(), v0, edge1, edge2, t_min, t_max, t, b1, b2);
+}
+
+// Iterative front-to-back traversal of the mesh BVH, shared by the closest-hit and any-hit queries
+template<bool any_hit>
+bool triangle_mesh::traverse(const ray& r, real t_min, real t_max, uint32_t& hit_tri, real& hit_t, real& b1, real& b2) const
+{
+    if(m_nodes.empty()) return false;
+
+    const auto origin = r.origin();
+    const auto direction = r.direction();
+    const vec3 inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+    const packet_ray pr(r);
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while(true)
+    {
+        const node& n = m_nodes[current];
+        if(n.box.hit(origin, inv_dir, t_min, t_max))
+        {
+            if(n.count > 0 && m_layout == mesh_layout::packets)
+            {
+                const uint32_t packet_count = (n.count + triangle_packet::width - 1) / triangle_packet::width;
+                for(uint32_t i = n.packets; i < n.packets + packet_count; i++)
+                {
+                    real t, u, v;
+                    int lane = intersect_packet(m_packets[i], pr, t_min, t_max, t, u, v);
+                    if(lane >= 0)
+                    {
+                        if(any_hit) return true;
+
+                        hit_anything = true;
+                        t_max = t;
+                        hit_t = t;
+                        hit_tri = m_packets[i].triangle[lane];
+                        b1 = u;
+                        b2 = v;
+                    }
+                }
+            }
+            else if(n.count > 0)
+            {
+                for(uint32_t i = n.first; i < n.first + n.count; i++)
+                {
+                    real t, u, v;
+                    if(intersect_triangle(m_triangles[i], r, t_min, t_max, t, u, v))
+                    {
+                        if(any_hit) return true;
+
+                        hit_anything = true;
+                        t_max = t;
+                        hit_t = t;
+                        hit_tri = m_triangles[i];
+                        b1 = u;
+                        b2 = v;
+                    }
+                }
+            }
+            else
+            {
+                // Visit the child on the near side of the split first so that t_max shrinks sooner
+                if(direction[n.axis] < 0)
+                {
+                    stack[stack_size++] = current + 1;
+                    current = n.first;
+                }
+                else
+                {
+                    stack[stack_size++] = n.first;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if(stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// Traversal of the compressed layout; every stack entry carries the decoded box of its node, which
+// the boxes of its children and the positions in its leaves are relative to
+template<bool any_hit>
+bool triangle_mesh::traverse_compressed(const ray& r, real t_min, real t_max, uint32_t& hit_tri, real& hit_t, real& b1, real& b2) const
+{
+    if(m_compressed_nodes.empty()) return false;
+
+    const auto origin = r.origin();
+    const auto direction = r.direction();
+    const vec3 inv_dir(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+    const packet_ray pr(r);
+
+    if(!m_root_box.hit(origin, inv_dir, t_min, t_max)) return false;
+
+    struct entry
+    {
+        uint32_t index;
+        aabb box;
+    };
+    entry stack[64];
+    int stack_size = 0;
+    entry current = {0, m_root_box};
+    bool hit_anything = false;
+
+    while(true)
+    {
+        const compressed_node& n = m_compressed_nodes[current.index];
+        if(n.count > 0)
+        {
+            const quantized_frame frame(current.box.min(), current.box.max());
+            const uint32_t packet_count = (n.count + quantized_triangle_packet::width - 1) / quantized_triangle_packet::width;
+            for(uint32_t i = 0; i < packet_count; i++)
+            {
+                real t, u, v;
+                int lane = intersect_packet(m_quantized_packets[n.packets + i], frame, pr, t_min, t_max, t, u, v);
+                if(lane >= 0)
+                {
+                    if(any_hit) return true;
+
+                    hit_anything = true;
+                    t_max = t;
+                    hit_t = t;
+                    hit_tri = m_triangles[n.first + i * quantized_triangle_packet::width + lane];
+                    b1 = u;
+                    b2 = v;
+                }
+            }
+        }
+        else
+        {
+            entry left = {current.index + 1, decode_child_box(current.box, n.bounds[0])};
+            entry right = {n.first, decode_child_box(current.box, n.bounds[1])};
+            bool hit_left = left.box.hit(origin, inv_dir, t_min, t_max);
+            bool hit_right = right.box.hit(origin, inv_dir, t_min, t_max);
+
+            if(hit_left && hit_right)
+            {
+                // Near side of the split first, as in the full layout
+                bool right_first = direction[n.axis] < 0;
+                stack[stack_size++] = right_first ? left : right;
+                current = right_first ? right : left;
+                continue;
+            }
+            if(hit_left || hit_right)
+            {
+                current = hit_left ? left : right;
+                continue;
+            }
+        }
+
+        // Boxes on the stack are tested again, since t_max may have shrunk since they were pushed
+        bool found = false;
+        while(stack_size > 0 && !found)
+        {
+            current = stack[--stack_size];
+            found = current.box.hit(origin, inv_dir, t_min, t_max);
+        }
+        if(!found) break;
+    }
+
+    return hit_anything;
+}
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const
+{
+    uint32_t tri;
+    real t, b1, b2;
+    bool found = m_layout == mesh_layout::compressed ? traverse_compressed<false>(r, t_min, t_max, tri, t, b1, b2)
+                                                     : traverse<false>(r, t_min, t_max, tri, t, b1, b2);
+    if(!found) return false;
+
+    rec.t = t;
+    rec.primitive = tri;
+    rec.b1 = b1;
+    rec.b2 = b2;
+    rec.object = this;
+    return true;
+}
+
+void triangle_mesh::finalize(const ray& r, hit_record& rec) const
+{
+    const auto tri = rec.primitive;
+    const auto b1 = rec.b1;
+    const auto b2 = rec.b2;
+    const auto b0 = 1.0 - b1 - b2;
+    auto v0 = m_data->position(m_data->indices(tri, 0));
+    auto v1 = m_data->position(m_data->indices(tri, 1));
+    auto v2 = m_data->position(m_data->indices(tri, 2));
+    vec3 outward_normal = unit_vector(cross(v1 - v0, v2 - v0));
+
+    // Interpolated vertex normals are used for shading when the mesh provides them
+    if(m_data->has_normals())
+    {
+        const auto& nidx = m_data->normal_indices;
+        vec3 shading_normal;
+        if(m_layout == mesh_layout::compressed)
+        {
+            shading_normal = b0 * decode_octahedral(m_octahedral_normals[nidx(tri, 0)]) + b1 * decode_octahedral(m_octahedral_normals[nidx(tri, 1)])
+                           + b2 * decode_octahedral(m_octahedral_normals[nidx(tri, 2)]);
+        }
+        else
+        {
+            shading_normal = b0 * m_data->normal(nidx(tri, 0)) + b1 * m_data->normal(nidx(tri, 1)) + b2 * m_data->normal(nidx(tri, 2));
+        }
+        if(shading_normal.length_squared() > 0) outward_normal = unit_vector(shading_normal);
+    }
+
+    if(needs_uv(m_mat.get()) && m_data->has_uvs())
+    {
+        uint32_t tidx[3] = {m_data->uv_indices(tri, 0), m_data->uv_indices(tri, 1), m_data->uv_indices(tri, 2)};
+        rec.u = b0 * m_data->tu[tidx[0]] + b1 * m_data->tu[tidx[1]] + b2 * m_data->tu[tidx[2]];
+        rec.v = b0 * m_data->tv[tidx[0]] + b1 * m_data->tv[tidx[1]] + b2 * m_data->tv[tidx[2]];
+    }
+    else
+    {
+        rec.u = b1;
+        rec.v = b2;
+    }
+
+    rec.p = r.at(rec.t);
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = m_mat.get();
+}
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const
+{
+    uint32_t tri;
+    real t, b1, b2;
+    if(m_layout == mesh_layout::compressed) return traverse_compressed<true>(r, t_min, t_max, tri, t, b1, b2);
+    return traverse<true>(r, t_min, t_max, tri, t, b1, b2);
+}
+
+#endif
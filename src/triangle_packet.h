@@ -0,0 +1,367 @@
+#ifndef _TRIANGLE_PACKET_h
+#define _TRIANGLE_PACKET_h
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include "utilities.h"
+
+// The packet width follows the widest instruction set enabled at compile time:
+// 8 lanes with AVX2 (-mavx2), 4 lanes with SSE, and a scalar 4-lane loop otherwise
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define TRIANGLE_PACKET_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define TRIANGLE_PACKET_SSE
+#endif
+
+
+// Moller-Trumbore ray-triangle intersection on a triangle given by a vertex and two edges
+// Returns the ray parameter and the barycentric coordinates of the second and third vertices
+inline bool intersect_triangle(const point3& origin, const vec3& direction, const point3& v0, const vec3& edge1, const vec3& edge2,
+                               real t_min, real t_max, real& t, real& b1, real& b2)
+{
+    auto pvec = cross(direction, edge2);
+    auto det = dot(edge1, pvec);
+    if(std::fabs(det) < 1e-12) return false;
+
+    auto inv_det = 1.0 / det;
+    auto tvec = origin - v0;
+    b1 = dot(tvec, pvec) * inv_det;
+    if(b1 < 0 || b1 > 1) return false;
+
+    auto qvec = cross(tvec, edge1);
+    b2 = dot(direction, qvec) * inv_det;
+    if(b2 < 0 || b1 + b2 > 1) return false;
+
+    t = dot(edge2, qvec) * inv_det;
+    return t >= t_min && t <= t_max;
+}
+
+
+// Group of triangles stored as structure-of-arrays in single precision, so that one ray
+// can be tested against all of them at once. Unused lanes hold degenerate triangles that never hit
+struct triangle_packet
+{
+#if defined(TRIANGLE_PACKET_AVX2)
+    static const int width = 8;
+#else
+    static const int width = 4;
+#endif
+
+    alignas(32) float v0x[width], v0y[width], v0z[width];
+    alignas(32) float e1x[width], e1y[width], e1z[width];
+    alignas(32) float e2x[width], e2y[width], e2z[width];
+    uint32_t triangle[width];
+
+    triangle_packet()
+    {
+        for(int i = 0; i < width; i++)
+        {
+            v0x[i] = v0y[i] = v0z[i] = 0;
+            e1x[i] = e1y[i] = e1z[i] = 0;
+            e2x[i] = e2y[i] = e2z[i] = 0;
+            triangle[i] = 0;
+        }
+    }
+
+    void set(int lane, uint32_t tri, const point3& v0, const point3& v1, const point3& v2)
+    {
+        auto edge1 = v1 - v0;
+        auto edge2 = v2 - v0;
+        v0x[lane] = static_cast<float>(v0.x()); v0y[lane] = static_cast<float>(v0.y()); v0z[lane] = static_cast<float>(v0.z());
+        e1x[lane] = static_cast<float>(edge1.x()); e1y[lane] = static_cast<float>(edge1.y()); e1z[lane] = static_cast<float>(edge1.z());
+        e2x[lane] = static_cast<float>(edge2.x()); e2y[lane] = static_cast<float>(edge2.y()); e2z[lane] = static_cast<float>(edge2.z());
+        triangle[lane] = tri;
+    }
+};
+
+
+// Single-precision copy of a ray, prepared once per traversal for packet tests
+struct packet_ray
+{
+    float ox, oy, oz;
+    float dx, dy, dz;
+
+    packet_ray(const ray& r)
+    : ox(static_cast<float>(r.origin().x())), oy(static_cast<float>(r.origin().y())), oz(static_cast<float>(r.origin().z())),
+      dx(static_cast<float>(r.direction().x())), dy(static_cast<float>(r.direction().y())), dz(static_cast<float>(r.direction().z())) {}
+};
+
+
+// Vertex coordinates quantized to 16 bits within a box, which is stored elsewhere and passed in
+// as a quantized_frame. Holds the same triangles as a triangle_packet in less than half the space;
+// positions are decoded while intersecting. Unused lanes are all zero, degenerate triangles that never hit
+struct quantized_triangle_packet
+{
+    static const int width = triangle_packet::width;
+
+    // Coordinates of vertex k of every lane
+    alignas(16) uint16_t x[3][width];
+    alignas(16) uint16_t y[3][width];
+    alignas(16) uint16_t z[3][width];
+
+    quantized_triangle_packet()
+    {
+        for(int k = 0; k < 3; k++)
+        {
+            for(int i = 0; i < width; i++) x[k][i] = y[k][i] = z[k][i] = 0;
+        }
+    }
+
+    void set(int lane, const uint16_t v0[3], const uint16_t v1[3], const uint16_t v2[3])
+    {
+        const uint16_t* v[3] = {v0, v1, v2};
+        for(int k = 0; k < 3; k++)
+        {
+            x[k][lane] = v[k][0];
+            y[k][lane] = v[k][1];
+            z[k][lane] = v[k][2];
+        }
+    }
+};
+
+// Box that quantized coordinates are relative to: a coordinate q decodes to offset + q * scale
+struct quantized_frame
+{
+    float offset[3];
+    float scale[3];
+
+    quantized_frame() {}
+    quantized_frame(const point3& min, const point3& max)
+    {
+        for(int a = 0; a < 3; a++)
+        {
+            offset[a] = static_cast<float>(min[a]);
+            scale[a] = static_cast<float>((max[a] - min[a]) / 65535.0);
+        }
+    }
+
+    uint16_t encode(real value, int axis) const
+    {
+        if(scale[axis] <= 0) return 0;
+        auto q = std::round((static_cast<float>(value) - offset[axis]) / scale[axis]);
+        return static_cast<uint16_t>(q < 0 ? 0 : (q > 65535 ? 65535 : q));
+    }
+
+    float decode(uint16_t q, int axis) const { return offset[axis] + q * scale[axis]; }
+};
+
+
+// Moller-Trumbore on all lanes at once and the closest hit in [t_min, t_max] picked with lane masks
+// Returns the lane of the closest hit or -1 if nothing is hit
+#if defined(TRIANGLE_PACKET_AVX2)
+inline int intersect_lanes(const __m256 v0x, const __m256 v0y, const __m256 v0z,
+                           const __m256 e1x, const __m256 e1y, const __m256 e1z,
+                           const __m256 e2x, const __m256 e2y, const __m256 e2z,
+                           const packet_ray& r, real t_min, real t_max, real& t, real& b1, real& b2)
+{
+    const __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+    const __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+
+    const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    const __m256 inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+    const __m256 tx = _mm256_sub_ps(ox, v0x);
+    const __m256 ty = _mm256_sub_ps(oy, v0y);
+    const __m256 tz = _mm256_sub_ps(oz, v0z);
+    const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), inv_det);
+
+    const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+    const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+    const __m256 dist = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+    __m256 mask = _mm256_cmp_ps(abs_det, _mm256_set1_ps(1e-12f), _CMP_GE_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist, _mm256_set1_ps(static_cast<float>(t_min)), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(dist, _mm256_set1_ps(static_cast<float>(t_max)), _CMP_LE_OQ));
+    if(_mm256_movemask_ps(mask) == 0) return -1;
+
+    // Horizontal minimum over the valid lanes, then the first lane holding it
+    __m256 t_masked = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), dist, mask);
+    __m256 t_min_lanes = _mm256_min_ps(t_masked, _mm256_permute2f128_ps(t_masked, t_masked, 1));
+    t_min_lanes = _mm256_min_ps(t_min_lanes, _mm256_shuffle_ps(t_min_lanes, t_min_lanes, _MM_SHUFFLE(2, 3, 0, 1)));
+    t_min_lanes = _mm256_min_ps(t_min_lanes, _mm256_shuffle_ps(t_min_lanes, t_min_lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane_mask = _mm256_movemask_ps(_mm256_and_ps(mask, _mm256_cmp_ps(t_masked, t_min_lanes, _CMP_EQ_OQ)));
+    int lane = 0;
+    while(!(lane_mask & (1 << lane))) lane++;
+
+    alignas(32) float lanes[3][triangle_packet::width];
+    _mm256_store_ps(lanes[0], dist);
+    _mm256_store_ps(lanes[1], u);
+    _mm256_store_ps(lanes[2], v);
+
+    t = lanes[0][lane];
+    b1 = lanes[1][lane];
+    b2 = lanes[2][lane];
+    return lane;
+}
+#elif defined(TRIANGLE_PACKET_SSE)
+inline int intersect_lanes(const __m128 v0x, const __m128 v0y, const __m128 v0z,
+                           const __m128 e1x, const __m128 e1y, const __m128 e1z,
+                           const __m128 e2x, const __m128 e2y, const __m128 e2z,
+                           const packet_ray& r, real t_min, real t_max, real& t, real& b1, real& b2)
+{
+    const __m128 ox = _mm_set1_ps(r.ox), oy = _mm_set1_ps(r.oy), oz = _mm_set1_ps(r.oz);
+    const __m128 dx = _mm_set1_ps(r.dx), dy = _mm_set1_ps(r.dy), dz = _mm_set1_ps(r.dz);
+
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    const __m128 tx = _mm_sub_ps(ox, v0x);
+    const __m128 ty = _mm_sub_ps(oy, v0y);
+    const __m128 tz = _mm_sub_ps(oz, v0z);
+    const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+    const __m128 dist = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+    __m128 mask = _mm_cmpge_ps(abs_det, _mm_set1_ps(1e-12f));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(dist, _mm_set1_ps(static_cast<float>(t_min))));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(dist, _mm_set1_ps(static_cast<float>(t_max))));
+    if(_mm_movemask_ps(mask) == 0) return -1;
+
+    // Horizontal minimum over the valid lanes, then the first lane holding it
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 t_masked = _mm_or_ps(_mm_and_ps(mask, dist), _mm_andnot_ps(mask, inf));
+    __m128 t_min_lanes = _mm_min_ps(t_masked, _mm_shuffle_ps(t_masked, t_masked, _MM_SHUFFLE(2, 3, 0, 1)));
+    t_min_lanes = _mm_min_ps(t_min_lanes, _mm_shuffle_ps(t_min_lanes, t_min_lanes, _MM_SHUFFLE(1, 0, 3, 2)));
+    const int lane_mask = _mm_movemask_ps(_mm_and_ps(mask, _mm_cmpeq_ps(t_masked, t_min_lanes)));
+    int lane = 0;
+    while(!(lane_mask & (1 << lane))) lane++;
+
+    alignas(16) float lanes[3][triangle_packet::width];
+    _mm_store_ps(lanes[0], dist);
+    _mm_store_ps(lanes[1], u);
+    _mm_store_ps(lanes[2], v);
+
+    t = lanes[0][lane];
+    b1 = lanes[1][lane];
+    b2 = lanes[2][lane];
+    return lane;
+}
+#else
+// Scalar loop over the lanes, closest hit first
+inline int intersect_lanes(const float* v0x, const float* v0y, const float* v0z,
+                           const float* e1x, const float* e1y, const float* e1z,
+                           const float* e2x, const float* e2y, const float* e2z,
+                           const packet_ray& r, real t_min, real t_max, real& t, real& b1, real& b2)
+{
+    int lane = -1;
+    for(int i = 0; i < triangle_packet::width; i++)
+    {
+        real lt, lu, lv;
+        vec3 e1(e1x[i], e1y[i], e1z[i]);
+        vec3 e2(e2x[i], e2y[i], e2z[i]);
+        if(intersect_triangle(point3(r.ox, r.oy, r.oz), vec3(r.dx, r.dy, r.dz), point3(v0x[i], v0y[i], v0z[i]), e1, e2, t_min, t_max, lt, lu, lv))
+        {
+            t_max = lt;
+            lane = i;
+            t = static_cast<float>(lt);
+            b1 = static_cast<float>(lu);
+            b2 = static_cast<float>(lv);
+        }
+    }
+    return lane;
+}
+#endif
+
+// Tests one ray against all triangles of a packet
+// Returns the lane of the closest hit in [t_min, t_max] or -1 if nothing is hit
+inline int intersect_packet(const triangle_packet& pk, const packet_ray& r, real t_min, real t_max, real& t, real& b1, real& b2)
+{
+#if defined(TRIANGLE_PACKET_AVX2)
+    return intersect_lanes(_mm256_load_ps(pk.v0x), _mm256_load_ps(pk.v0y), _mm256_load_ps(pk.v0z),
+                           _mm256_load_ps(pk.e1x), _mm256_load_ps(pk.e1y), _mm256_load_ps(pk.e1z),
+                           _mm256_load_ps(pk.e2x), _mm256_load_ps(pk.e2y), _mm256_load_ps(pk.e2z),
+                           r, t_min, t_max, t, b1, b2);
+#elif defined(TRIANGLE_PACKET_SSE)
+    return intersect_lanes(_mm_load_ps(pk.v0x), _mm_load_ps(pk.v0y), _mm_load_ps(pk.v0z),
+                           _mm_load_ps(pk.e1x), _mm_load_ps(pk.e1y), _mm_load_ps(pk.e1z),
+                           _mm_load_ps(pk.e2x), _mm_load_ps(pk.e2y), _mm_load_ps(pk.e2z),
+                           r, t_min, t_max, t, b1, b2);
+#else
+    return intersect_lanes(pk.v0x, pk.v0y, pk.v0z, pk.e1x, pk.e1y, pk.e1z, pk.e2x, pk.e2y, pk.e2z, r, t_min, t_max, t, b1, b2);
+#endif
+}
+
+// Same test on a quantized packet, decoding the vertices within {frame} first
+inline int intersect_packet(const quantized_triangle_packet& pk, const quantized_frame& frame, const packet_ray& r,
+                            real t_min, real t_max, real& t, real& b1, real& b2)
+{
+#if defined(TRIANGLE_PACKET_AVX2)
+    __m256 v[3][3];
+    const uint16_t (*coords[3])[quantized_triangle_packet::width] = {pk.x, pk.y, pk.z};
+    for(int a = 0; a < 3; a++)
+    {
+        const __m256 scale = _mm256_set1_ps(frame.scale[a]);
+        const __m256 offset = _mm256_set1_ps(frame.offset[a]);
+        for(int k = 0; k < 3; k++)
+        {
+            const __m256i q = _mm256_cvtepu16_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(coords[a][k])));
+            v[k][a] = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(q), scale), offset);
+        }
+    }
+
+    return intersect_lanes(v[0][0], v[0][1], v[0][2],
+                           _mm256_sub_ps(v[1][0], v[0][0]), _mm256_sub_ps(v[1][1], v[0][1]), _mm256_sub_ps(v[1][2], v[0][2]),
+                           _mm256_sub_ps(v[2][0], v[0][0]), _mm256_sub_ps(v[2][1], v[0][1]), _mm256_sub_ps(v[2][2], v[0][2]),
+                           r, t_min, t_max, t, b1, b2);
+#elif defined(TRIANGLE_PACKET_SSE)
+    __m128 v[3][3];
+    const uint16_t (*coords[3])[quantized_triangle_packet::width] = {pk.x, pk.y, pk.z};
+    const __m128i zero = _mm_setzero_si128();
+    for(int a = 0; a < 3; a++)
+    {
+        const __m128 scale = _mm_set1_ps(frame.scale[a]);
+        const __m128 offset = _mm_set1_ps(frame.offset[a]);
+        for(int k = 0; k < 3; k++)
+        {
+            const __m128i q = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(coords[a][k])), zero);
+            v[k][a] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(q), scale), offset);
+        }
+    }
+
+    return intersect_lanes(v[0][0], v[0][1], v[0][2],
+                           _mm_sub_ps(v[1][0], v[0][0]), _mm_sub_ps(v[1][1], v[0][1]), _mm_sub_ps(v[1][2], v[0][2]),
+                           _mm_sub_ps(v[2][0], v[0][0]), _mm_sub_ps(v[2][1], v[0][1]), _mm_sub_ps(v[2][2], v[0][2]),
+                           r, t_min, t_max, t, b1, b2);
+#else
+    float v[3][3][quantized_triangle_packet::width];
+    const uint16_t (*coords[3])[quantized_triangle_packet::width] = {pk.x, pk.y, pk.z};
+    for(int a = 0; a < 3; a++)
+    {
+        for(int i = 0; i < quantized_triangle_packet::width; i++)
+        {
+            v[0][a][i] = frame.decode(coords[a][0][i], a);
+            v[1][a][i] = frame.decode(coords[a][1][i], a) - v[0][a][i];
+            v[2][a][i] = frame.decode(coords[a][2][i], a) - v[0][a][i];
+        }
+    }
+
+    return intersect_lanes(v[0][0], v[0][1], v[0][2], v[1][0], v[1][1], v[1][2], v[2][0], v[2][1], v[2][2], r, t_min, t_max, t, b1, b2);
+#endif
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define _UTILITIES_h
 
 #include <cmath>
+#include <limits>
 #include <memory>
 #include <random>
 #include "fastPRNG.h"
@@ -11,12 +12,20 @@
 using std::shared_ptr;
 using std::make_shared;
 
+// Scalar type of all geometry, colors and shading math
+// Builds with RAYTRACER_USE_FLOAT defined run in single precision
+#ifdef RAYTRACER_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = static_cast<real>(3.1415926535897932385);
 
 // Utility Functions
-inline double degrees_to_radians(double degrees) 
+inline real degrees_to_radians(real degrees) 
 {
     return degrees * pi / 180.0;
 }
@@ -57,7 +66,7 @@ int random_int(int start, int end)
 }
 
 
-double clamp(double value, double min, double max)
+real clamp(real value, real min, real max)
 {
     value = value < min ? min : value;
     value = value > max ? max : value;
@@ -6,32 +6,125 @@
 
 #include "utilities.h"
 
+// Optional SIMD backend, enabled by defining RAYTRACER_SIMD_VEC3
+// Vectors are padded to four lanes, aligned to a whole register, and arithmetic, dot, cross,
+// normalization, min and max run on whole registers. Double builds need AVX2 (-mavx2), float builds
+// SSE2; otherwise the scalar code is used. Every lane does the same operations in the same order
+// as the scalar code, so both give identical results. The fourth lane is padding and never read
+#if defined(RAYTRACER_SIMD_VEC3) && defined(RAYTRACER_USE_FLOAT) && (defined(__SSE2__) || defined(_M_X64))
+    #include <immintrin.h>
+    #define VEC3_SIMD
+
+    using vec3_lanes = __m128;
+    inline vec3_lanes lanes_load(const real* p) { return _mm_load_ps(p); }
+    inline void lanes_store(real* p, vec3_lanes v) { _mm_store_ps(p, v); }
+    inline vec3_lanes lanes_set1(real k) { return _mm_set1_ps(k); }
+    inline vec3_lanes lanes_add(vec3_lanes a, vec3_lanes b) { return _mm_add_ps(a, b); }
+    inline vec3_lanes lanes_sub(vec3_lanes a, vec3_lanes b) { return _mm_sub_ps(a, b); }
+    inline vec3_lanes lanes_mul(vec3_lanes a, vec3_lanes b) { return _mm_mul_ps(a, b); }
+    inline vec3_lanes lanes_div(vec3_lanes a, vec3_lanes b) { return _mm_div_ps(a, b); }
+    inline vec3_lanes lanes_min(vec3_lanes a, vec3_lanes b) { return _mm_min_ps(a, b); }
+    inline vec3_lanes lanes_max(vec3_lanes a, vec3_lanes b) { return _mm_max_ps(a, b); }
+    inline vec3_lanes lanes_negate(vec3_lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    inline vec3_lanes lanes_yzx(vec3_lanes a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    inline vec3_lanes lanes_zxy(vec3_lanes a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    // (x + y) + z of the first three lanes
+    inline real lanes_sum3(vec3_lanes a)
+    {
+        auto xy = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(a, a)));
+    }
+#elif defined(RAYTRACER_SIMD_VEC3) && !defined(RAYTRACER_USE_FLOAT) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define VEC3_SIMD
+
+    using vec3_lanes = __m256d;
+    inline vec3_lanes lanes_load(const real* p) { return _mm256_load_pd(p); }
+    inline void lanes_store(real* p, vec3_lanes v) { _mm256_store_pd(p, v); }
+    inline vec3_lanes lanes_set1(real k) { return _mm256_set1_pd(k); }
+    inline vec3_lanes lanes_add(vec3_lanes a, vec3_lanes b) { return _mm256_add_pd(a, b); }
+    inline vec3_lanes lanes_sub(vec3_lanes a, vec3_lanes b) { return _mm256_sub_pd(a, b); }
+    inline vec3_lanes lanes_mul(vec3_lanes a, vec3_lanes b) { return _mm256_mul_pd(a, b); }
+    inline vec3_lanes lanes_div(vec3_lanes a, vec3_lanes b) { return _mm256_div_pd(a, b); }
+    inline vec3_lanes lanes_min(vec3_lanes a, vec3_lanes b) { return _mm256_min_pd(a, b); }
+    inline vec3_lanes lanes_max(vec3_lanes a, vec3_lanes b) { return _mm256_max_pd(a, b); }
+    inline vec3_lanes lanes_negate(vec3_lanes a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+    inline vec3_lanes lanes_yzx(vec3_lanes a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    inline vec3_lanes lanes_zxy(vec3_lanes a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    // (x + y) + z of the first three lanes
+    inline real lanes_sum3(vec3_lanes a)
+    {
+        auto low = _mm256_castpd256_pd128(a);
+        auto xy = _mm_add_sd(low, _mm_unpackhi_pd(low, low));
+        return _mm_cvtsd_f64(_mm_add_sd(xy, _mm256_extractf128_pd(a, 1)));
+    }
+#endif
+
 // Vector class for storing 3D points, vectors, and colors
 // plus implements basic vector operations
 class vec3
 {
 public:
+#if defined(VEC3_SIMD)
+    // Constructors
+    vec3() : e{0, 0, 0, 0} {}
+    vec3(real x, real y, real z) : e{x, y, z, 0} {}
+    vec3(real x) : e{x, x, x, 0} {}
+    explicit vec3(vec3_lanes v) { lanes_store(e, v); }
+
+    vec3(vec3& other)=default;
+    vec3(const vec3& other)=default;
+    vec3& operator=(const vec3& other)=default;
+
+    vec3_lanes lanes() const { return lanes_load(e); }
+#else
     // Constructors
     vec3() : e{0, 0, 0} {}
-    vec3(double x, double y, double z) : e{x, y, z} {}
-    vec3(double x) : e{x, x, x} {}
+    vec3(real x, real y, real z) : e{x, y, z} {}
+    vec3(real x) : e{x, x, x} {}
 
     vec3(vec3& other)=default;
     vec3(const vec3& other)=default;
     vec3& operator=(const vec3& other)=default;
+#endif
 
     // vec3(const vec3&& other) : e(std::move(other.e)) {}
 
     // Access individual elements
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
 
     // Indexing operators
-    inline double operator[](int idx) const { return e[idx]; }
-    inline double& operator[](int idx) { return e[idx]; }
+    inline real operator[](int idx) const { return e[idx]; }
+    inline real& operator[](int idx) { return e[idx]; }
+
+
+#if defined(VEC3_SIMD)
+    // Arithmetic operators
+    vec3 operator-() const { return vec3(lanes_negate(lanes())); }
+
+    vec3& operator+=(const vec3& other) { lanes_store(e, lanes_add(lanes(), other.lanes())); return *this; }
+    vec3& operator-=(const vec3& other) { lanes_store(e, lanes_sub(lanes(), other.lanes())); return *this; }
+    vec3& operator*=(const vec3& other) { lanes_store(e, lanes_mul(lanes(), other.lanes())); return *this; }
+    vec3& operator*=(const real k) { lanes_store(e, lanes_mul(lanes(), lanes_set1(k))); return *this; }
+    vec3& operator/=(const vec3& other) { lanes_store(e, lanes_div(lanes(), other.lanes())); return *this; }
+    vec3& operator/=(const real k) { lanes_store(e, lanes_div(lanes(), lanes_set1(k))); return *this; }
 
+    // Vector convenience operations
+    real length_squared() const
+    {
+        auto v = lanes();
+        return lanes_sum3(lanes_mul(v, v));
+    }
 
+    inline real length() const
+    {
+        return std::sqrt(length_squared());
+    }
+#else
     // Arithmetic operators
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
 
@@ -59,7 +152,7 @@ public:
         return *this;
     }
 
-    vec3& operator*=(const double k)
+    vec3& operator*=(const real k)
     {
         e[0] *= k;
         e[1] *= k;
@@ -75,7 +168,7 @@ public:
         return *this;
     }
 
-    vec3& operator/=(const double k)
+    vec3& operator/=(const real k)
     {
         e[0] /= k;
         e[1] /= k;
@@ -84,15 +177,16 @@ public:
     }
 
     // Vector convenience operations
-    double length_squared() const
+    real length_squared() const
     {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
 
-    inline double length() const
+    inline real length() const
     {
         return std::sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
     }
+#endif
 
     bool near_zero() const
     {
@@ -106,14 +200,18 @@ public:
         return vec3(random_double(), random_double(), random_double());
     }
 
-    inline static vec3 random(double min, double max)
+    inline static vec3 random(real min, real max)
     {
         return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
     }
 
 private:
-    // std::array<double, 3> e;
-    double e[3];
+    // std::array<real, 3> e;
+#if defined(VEC3_SIMD)
+    alignas(sizeof(vec3_lanes)) real e[4];
+#else
+    real e[3];
+#endif
 };
 
 
@@ -127,6 +225,19 @@ using color = vec3;
 
 
 // Operator overloads
+#if defined(VEC3_SIMD)
+inline vec3 operator+(const vec3& v1, const vec3& v2) { return vec3(lanes_add(v1.lanes(), v2.lanes())); }
+inline vec3 operator+(const vec3& v, const real k) { return vec3(lanes_add(v.lanes(), lanes_set1(k))); }
+inline vec3 operator+(const real k, const vec3& v) { return vec3(lanes_add(lanes_set1(k), v.lanes())); }
+inline vec3 operator-(const vec3& v1, const vec3& v2) { return vec3(lanes_sub(v1.lanes(), v2.lanes())); }
+inline vec3 operator-(const vec3& v, const real k) { return vec3(lanes_sub(v.lanes(), lanes_set1(k))); }
+inline vec3 operator-(const real k, const vec3& v) { return vec3(lanes_sub(lanes_set1(k), v.lanes())); }
+inline vec3 operator*(const vec3& v1, const vec3& v2) { return vec3(lanes_mul(v1.lanes(), v2.lanes())); }
+inline vec3 operator*(const vec3& v, const real k) { return vec3(lanes_mul(v.lanes(), lanes_set1(k))); }
+inline vec3 operator*(const real k, const vec3& v) { return vec3(lanes_mul(lanes_set1(k), v.lanes())); }
+inline vec3 operator/(const vec3& v1, const vec3& v2) { return vec3(lanes_div(v1.lanes(), v2.lanes())); }
+inline vec3 operator/(const vec3& v1, const real k) { return vec3(lanes_div(v1.lanes(), lanes_set1(k))); }
+#else
 inline vec3 operator+(const vec3& v1, const vec3& v2)
 {
     return vec3(v1[0] + v2[0],
@@ -134,14 +245,14 @@ inline vec3 operator+(const vec3& v1, const vec3& v2)
                 v1[2] + v2[2]);
 }
 
-inline vec3 operator+(const vec3& v, const double k)
+inline vec3 operator+(const vec3& v, const real k)
 {
     return vec3(v[0] + k,
                 v[1] + k,
                 v[2] + k);
 }
 
-inline vec3 operator+(const double k, const vec3& v)
+inline vec3 operator+(const real k, const vec3& v)
 {
     return vec3(k + v[0],
                 k + v[1],
@@ -155,14 +266,14 @@ inline vec3 operator-(const vec3& v1, const vec3& v2)
                 v1[2] - v2[2]);
 }
 
-inline vec3 operator-(const vec3& v, const double k)
+inline vec3 operator-(const vec3& v, const real k)
 {
     return vec3(v[0] - k,
                 v[1] - k,
                 v[2] - k);
 }
 
-inline vec3 operator-(const double k, const vec3& v)
+inline vec3 operator-(const real k, const vec3& v)
 {
     return vec3(k - v[0],
                 k - v[1],
@@ -176,14 +287,14 @@ inline vec3 operator*(const vec3& v1, const vec3& v2)
                 v1[2] * v2[2]);
 }
 
-inline vec3 operator*(const vec3& v, const double k)
+inline vec3 operator*(const vec3& v, const real k)
 {
     return vec3(v[0] * k,
                 v[1] * k,
                 v[2] * k);
 }
 
-inline vec3 operator*(const double k, const vec3& v)
+inline vec3 operator*(const real k, const vec3& v)
 {
     return vec3(k * v[0],
                 k * v[1],
@@ -197,12 +308,13 @@ inline vec3 operator/(const vec3& v1, const vec3& v2)
                 v1[2] / v2[2]);
 }
 
-inline vec3 operator/(const vec3& v1, const double k)
+inline vec3 operator/(const vec3& v1, const real k)
 {
     return vec3(v1[0] / k,
                 v1[1] / k,
                 v1[2] / k);
 }
+#endif
 
 inline std::ostream& operator<<(std::ostream& out, const vec3& v)
 {
@@ -212,7 +324,30 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v)
 
 
 // Vector operations
-inline double dot(const vec3& v1, const vec3& v2)
+#if defined(VEC3_SIMD)
+inline real dot(const vec3& v1, const vec3& v2)
+{
+    return lanes_sum3(lanes_mul(v1.lanes(), v2.lanes()));
+}
+
+// Component k is v1[k+1] * v2[k+2] - v1[k+2] * v2[k+1], indices modulo 3
+inline vec3 cross(const vec3& v1, const vec3& v2)
+{
+    auto a = v1.lanes();
+    auto b = v2.lanes();
+    return vec3(lanes_sub(lanes_mul(lanes_yzx(a), lanes_zxy(b)), lanes_mul(lanes_zxy(a), lanes_yzx(b))));
+}
+
+inline vec3 unit_vector(const vec3& v)
+{
+    return vec3(lanes_div(v.lanes(), lanes_set1(v.length())));
+}
+
+// Componentwise minimum and maximum
+inline vec3 component_min(const vec3& v1, const vec3& v2) { return vec3(lanes_min(v1.lanes(), v2.lanes())); }
+inline vec3 component_max(const vec3& v1, const vec3& v2) { return vec3(lanes_max(v1.lanes(), v2.lanes())); }
+#else
+inline real dot(const vec3& v1, const vec3& v2)
 {
     return v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2];
 }
@@ -229,6 +364,18 @@ inline vec3 unit_vector(const vec3& v)
     return v / v.length();
 }
 
+// Componentwise minimum and maximum
+inline vec3 component_min(const vec3& v1, const vec3& v2)
+{
+    return vec3(fmin(v1[0], v2[0]), fmin(v1[1], v2[1]), fmin(v1[2], v2[2]));
+}
+
+inline vec3 component_max(const vec3& v1, const vec3& v2)
+{
+    return vec3(fmax(v1[0], v2[0]), fmax(v1[1], v2[1]), fmax(v1[2], v2[2]));
+}
+#endif
+
 
 
 // Random vector generation functions for computing scattering
@@ -269,6 +416,18 @@ vec3 random_in_unit_disk()
     }
 }
 
+// Direction in the hemisphere around +z with a density of cos(theta) / pi, taken from a uniform point on the
+// unit disk lifted up onto the hemisphere, so it needs no rejection loop
+vec3 random_cosine_direction()
+{
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto phi = 2 * pi * r1;
+    auto r = sqrt(r2);
+
+    return vec3(cos(phi) * r, sin(phi) * r, sqrt(1 - r2));
+}
+
 
 
 // Vector functions for computing ray reflection and refraction upon hitting materials
@@ -277,7 +436,7 @@ vec3 reflect(const vec3& normal, const vec3& v)
     return v + 2 * dot(normal, -v) * normal;
 }
 
-vec3 refract(const vec3& normal, const vec3& v, double etai_over_etat)
+vec3 refract(const vec3& normal, const vec3& v, real etai_over_etat)
 {
     vec3 unit_v = unit_vector(v);
     auto cos_theta = fmin(dot(-unit_v, normal), 1.0);
@@ -0,0 +1,84 @@
+#ifndef _WAVEFRONT_h
+#define _WAVEFRONT_h
+
+#include <vector>
+#include <algorithm>
+#include "utilities.h"
+#include "hittable.h"
+#include "material_table.h"
+
+// Queues for the wavefront integrator, which moves a whole batch of paths through one stage at a time
+// (generate, intersect, shade, accumulate) instead of following each path to its end
+// Between stages the queues are sorted, rays by the octant of their direction so that neighbouring rays
+// visit similar parts of the scene, and hits by material so that each material's code and data stay hot
+
+// A path in flight: the ray it continues with, the product of the attenuations along it so far,
+// the pixel it adds to, and the density its last bounce picked {r} with (0 if the lights weren't sampled there)
+struct wavefront_path
+{
+    ray r;
+    color throughput;
+    int pixel;
+    real scatter_pdf = 0;
+};
+
+// Index 0-7 from the signs of the direction's components
+inline int direction_octant(const vec3& direction)
+{
+    return (direction.x() < 0 ? 1 : 0) | (direction.y() < 0 ? 2 : 0) | (direction.z() < 0 ? 4 : 0);
+}
+
+// Stable counting sort of {paths} by direction octant, using {scratch} as the output buffer
+void sort_by_octant(std::vector<wavefront_path>& paths, std::vector<wavefront_path>& scratch)
+{
+    size_t start[9] = {};
+    for(const auto& path : paths) start[direction_octant(path.r.direction()) + 1]++;
+    for(int o = 0; o < 8; o++) start[o + 1] += start[o];
+
+    scratch.resize(paths.size());
+    for(const auto& path : paths) scratch[start[direction_octant(path.r.direction())]++] = path;
+    paths.swap(scratch);
+}
+
+// Orders the paths that hit something by the id of the material they hit in the scene's material_table
+// Ids are grouped by kind of material, so this is also an order by kind. The paths are counting sorted into
+// one bucket per id, so paths that hit the same material keep their order (by direction octant) within it
+class material_sorter
+{
+public:
+    void sort(const std::vector<hit_record>& hits, const std::vector<char>& hit, const material_table& materials);
+
+    // Indices into the hits passed to sort()
+    const std::vector<uint32_t>& order() const { return m_order; }
+
+private:
+    std::vector<uint32_t> m_path_id;
+    std::vector<uint32_t> m_start;
+    std::vector<uint32_t> m_order;
+};
+
+void material_sorter::sort(const std::vector<hit_record>& hits, const std::vector<char>& hit, const material_table& materials)
+{
+    // One more bucket at the end for materials the table doesn't know
+    m_start.assign(materials.size() + 2, 0);
+    m_path_id.resize(hits.size());
+
+    uint32_t hit_count = 0;
+    for(size_t i = 0; i < hits.size(); i++)
+    {
+        if(!hit[i]) continue;
+        hit_count++;
+
+        m_path_id[i] = materials.id(hits[i].mat_ptr);
+        m_start[m_path_id[i] + 1]++;
+    }
+    for(size_t b = 1; b < m_start.size(); b++) m_start[b] += m_start[b - 1];
+
+    m_order.resize(hit_count);
+    for(uint32_t i = 0; i < hits.size(); i++)
+    {
+        if(hit[i]) m_order[m_start[m_path_id[i]]++] = i;
+    }
+}
+
+#endif